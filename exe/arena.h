@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Growable array whose storage comes from an Arena.
+template<typename T>
+using ArenaVector = std::pmr::vector<T>;
+
+// Memory for the parser state of one executable.
+//
+// Everything the parser builds (section ranges, resource directories, the
+// icon group) is allocated by bumping a pointer, first through a buffer inside
+// the arena itself and then through larger chunks from the heap. Nothing is
+// freed until the arena goes away, all at once, so a typical file costs no
+// heap allocations for parsing at all.
+class Arena {
+public:
+    Arena() : memory{buffer, sizeof(buffer)} {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    std::pmr::memory_resource *resource() { return &memory; }
+
+private:
+    static constexpr std::size_t INLINE_SIZE = 4096;
+
+    alignas(std::max_align_t) std::byte buffer[INLINE_SIZE];
+    std::pmr::monotonic_buffer_resource memory;
+};
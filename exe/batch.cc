@@ -0,0 +1,162 @@
+#include "batch.h"
+#include "exeicons.h"
+#include "trace.h"
+
+#include <QFile>
+#include <QThread>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// A worker's share of the batch, as a range of file indices. The owner takes
+// from the front and thieves take the back half, so they rarely meet.
+struct Share {
+    std::mutex mutex;
+    int begin = 0;
+    int end = 0;
+};
+
+class Batch {
+public:
+    Batch(const QStringList &paths, const QVector<QSize> &targetSizes, const BatchOptions &options,
+          const std::function<void(BatchItem &)> &done, int threads)
+        : paths{paths}, targetSizes{targetSizes}, options{options}, done{done}, shares(threads)
+    {
+        // Contiguous shares keep each worker's files close together on disk.
+        int count = paths.size();
+        for (int i = 0; i < threads; i++) {
+            shares[i].begin = int(qint64(count) * i / threads);
+            shares[i].end = int(qint64(count) * (i + 1) / threads);
+        }
+    }
+
+    void work(int self) {
+        for (int index; (index = next(self)) >= 0;) {
+            extract(index);
+        }
+    }
+
+private:
+    int next(int self);
+    bool steal(int self);
+    void extract(int index);
+
+    const QStringList &paths;
+    const QVector<QSize> &targetSizes;
+    const BatchOptions &options;
+    const std::function<void(BatchItem &)> &done;
+    std::vector<Share> shares;
+    std::mutex doneMutex;
+};
+
+int Batch::next(int self) {
+    auto &own = shares[self];
+    do {
+        std::lock_guard<std::mutex> lock{own.mutex};
+        if (own.begin < own.end) {
+            return own.begin++;
+        }
+    } while (steal(self));
+    return -1;
+}
+
+// Moves the back half of the largest remaining share to `self`. Shares only
+// ever shrink, so once every one is empty the batch is done.
+bool Batch::steal(int self) {
+    while (true) {
+        int victim = -1, most = 0;
+        for (int i = 0; i < int(shares.size()); i++) {
+            if (i == self) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock{shares[i].mutex};
+            if (shares[i].end - shares[i].begin > most) {
+                most = shares[i].end - shares[i].begin;
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+
+        int begin, end;
+        {
+            std::lock_guard<std::mutex> lock{shares[victim].mutex};
+            auto &share = shares[victim];
+            int remaining = share.end - share.begin;
+            if (remaining <= 0) {
+                // Someone else got there first; look again.
+                continue;
+            }
+            end = share.end;
+            begin = share.end - qMax(1, remaining / 2);
+            share.end = begin;
+        }
+
+        std::lock_guard<std::mutex> lock{shares[self].mutex};
+        shares[self].begin = begin;
+        shares[self].end = end;
+        return true;
+    }
+}
+
+void Batch::extract(int index) {
+    const auto &path = paths[index];
+
+    // One record per file, covering the parse and every size rendered from it.
+    std::optional<Trace> trace;
+    if (Trace::enabled()) {
+        trace.emplace(path, targetSizes.size() == 1 ? targetSizes.first() : QSize());
+    }
+
+    QFile file{path};
+    std::unique_ptr<ExecutableIcons> icons;
+    if (file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        icons = std::make_unique<ExecutableIcons>(&file, options.extraction);
+    } else if (trace) {
+        trace->fail("unable to open");
+    }
+
+    for (auto targetSize : targetSizes) {
+        BatchItem item;
+        item.index = index;
+        item.path = path;
+        item.targetSize = targetSize;
+        if (icons) {
+            item.image = icons->render(targetSize, &item.stats);
+        }
+
+        if (options.concurrentCallback) {
+            done(item);
+        } else {
+            std::lock_guard<std::mutex> lock{doneMutex};
+            done(item);
+        }
+    }
+}
+
+}
+
+void extractBatch(const QStringList &paths, const QVector<QSize> &targetSizes, const BatchOptions &options,
+                  const std::function<void(BatchItem &)> &done) {
+    int threads = options.threads > 0 ? options.threads : QThread::idealThreadCount();
+    threads = qBound(1, threads, qMax(1, int(paths.size())));
+
+    Batch batch{paths, targetSizes, options, done, threads};
+
+    // The calling thread works too.
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back([&batch, i] { batch.work(i); });
+    }
+    batch.work(0);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
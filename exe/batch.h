@@ -0,0 +1,41 @@
+#pragma once
+#include "exeutil.h"
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+// One file at one target size.
+struct BatchItem {
+    // Position of the file in the list passed to extractBatch().
+    int index = -1;
+    QString path;
+    QSize targetSize;
+    // Null if the file has no usable icon or couldn't be read.
+    QImage image;
+    ExtractionStats stats;
+};
+
+struct BatchOptions {
+    ExtractionOptions extraction;
+    // Worker threads, including the calling one; 0 means one per core.
+    int threads = 0;
+    // Lets workers call `done` at the same time, for callbacks that do heavy
+    // lifting of their own, such as encoding the image.
+    bool concurrentCallback = false;
+};
+
+// Extracts the icon of every file at every target size, spread across
+// threads. Each file is parsed once and rendered at all sizes by the same
+// worker. Workers start with equal shares of the list and steal from each
+// other once theirs runs out, so a few slow files don't hold up the rest.
+//
+// `done` receives each result as soon as it is ready, i.e. in completion
+// order. It is called on the worker threads, but never concurrently unless
+// asked for. Returns once every file has been handled.
+void extractBatch(const QStringList &paths, const QVector<QSize> &targetSizes, const BatchOptions &options,
+                  const std::function<void(BatchItem &)> &done);
@@ -0,0 +1,507 @@
+// Corpus benchmark: runs getIconForWindowsExecutable over every file in a
+// directory tree and reports latency, throughput and I/O statistics.
+
+#include "exeutil.h"
+#include "fixtures.h"
+#include "pixelpool.h"
+#include "trace.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <fcntl.h>
+
+// Every heap allocation in the process goes through here, so the benchmark
+// can report how many each extraction makes.
+namespace {
+std::atomic<qint64> allocations{0};
+}
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+// Forwards to a file without exposing it as a QFileDevice, which keeps
+// ByteSource from mapping it and forces the buffered read path. With a
+// latency set, every read and every seek that moves the position costs that
+// long, which stands in for a remote (KIO, NFS, SMB) file.
+class UnmappedDevice : public QIODevice {
+public:
+    explicit UnmappedDevice(QIODevice *inner, int latencyUsecs = 0)
+        : inner{inner}, latencyUsecs{latencyUsecs}
+    {
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return false; }
+    qint64 size() const override { return inner->size(); }
+
+    bool seek(qint64 pos) override {
+        if (pos != inner->pos()) {
+            roundTrip();
+        }
+        return QIODevice::seek(pos) && inner->seek(pos);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override {
+        roundTrip();
+        return inner->read(data, maxSize);
+    }
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    void roundTrip() {
+        if (latencyUsecs > 0) {
+            QThread::usleep(latencyUsecs);
+        }
+    }
+
+    QIODevice *inner;
+    int latencyUsecs;
+};
+
+struct Sample {
+    QString path;
+    QSize targetSize;
+    qint64 nsecs = 0;
+    qint64 allocations = 0;
+    bool ok = false;
+    ExtractionStats stats;
+};
+
+struct Summary {
+    QVector<qint64> nsecs;
+    int failures = 0;
+    qint64 bytesRead = 0;
+    qint64 reads = 0;
+    qint64 seeks = 0;
+    qint64 readsSaved = 0;
+    QVector<qint64> allocations;
+
+    void add(const Sample &sample) {
+        nsecs.append(sample.nsecs);
+        allocations.append(sample.allocations);
+        if (!sample.ok) { failures++; }
+        bytesRead += sample.stats.io.bytesRead;
+        reads += sample.stats.io.reads;
+        seeks += sample.stats.io.seeks;
+        readsSaved += sample.stats.io.readsSaved;
+    }
+};
+
+QString iconKind(const Sample &sample) {
+    if (!sample.ok) { return QStringLiteral("none"); }
+    return QString::fromLatin1(sample.stats.icon.png ? "png" : "dib");
+}
+
+qint64 percentile(QVector<qint64> values, int p) {
+    if (values.isEmpty()) { return 0; }
+    std::sort(values.begin(), values.end());
+    auto rank = (qint64(values.size()) * p + 99) / 100;
+    return values[int(qBound<qint64>(1, rank, values.size()) - 1)];
+}
+
+QString usecs(qint64 nsecs) {
+    return QString::number(double(nsecs) / 1000.0, 'f', 1);
+}
+
+void dropFromPageCache(const QString &path) {
+    QFile file{path};
+    if (file.open(QIODevice::ReadOnly)) {
+        ::posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+Sample runOne(const QString &path, QSize targetSize, const ExtractionOptions &options, bool mmap, int latencyUsecs) {
+    Sample sample;
+    sample.path = path;
+    sample.targetSize = targetSize;
+
+    // Mirror what ExeCreator::create does, including opening the file.
+    QElapsedTimer timer;
+    timer.start();
+    QFile file{path};
+    if (file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        QImage image;
+        if (mmap) {
+            auto before = allocations.load(std::memory_order_relaxed);
+            image = getIconForWindowsExecutable(&file, targetSize, options, &sample.stats);
+            sample.allocations = allocations.load(std::memory_order_relaxed) - before;
+        } else {
+            UnmappedDevice device{&file, latencyUsecs};
+            auto before = allocations.load(std::memory_order_relaxed);
+            image = getIconForWindowsExecutable(&device, targetSize, options, &sample.stats);
+            sample.allocations = allocations.load(std::memory_order_relaxed) - before;
+        }
+        sample.ok = !image.isNull();
+    }
+    sample.nsecs = timer.nsecsElapsed();
+    return sample;
+}
+
+// Headroom over the measured baseline: a quarter more of everything, but at
+// least one cache block, two reads and seeks and 32 allocations, so that the
+// smallest fixtures don't fail over a stray Qt-internal allocation or an
+// extra block.
+constexpr int BUDGET_MARGIN_PERCENT = 25;
+constexpr int MIN_MARGIN_READS = 2;
+constexpr int MIN_MARGIN_ALLOCATIONS = 32;
+
+template<typename T>
+T withMargin(T measured, T minimum) {
+    return measured + qMax(T((measured * BUDGET_MARGIN_PERCENT + 99) / 100), minimum);
+}
+
+// Measures every file at every size, mapped and through the buffered path,
+// and writes the most each needed, plus the margin, as its budget.
+bool recordBudgets(const QString &path, const QStringList &files, const QVector<QSize> &sizes,
+                   const ExtractionOptions &options) {
+    QFile file{path};
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Unable to write %s", qPrintable(path));
+        return false;
+    }
+
+    // Keep loading Qt's PNG plugin and filling the pixel pool out of the
+    // measurements, as the checks do.
+    for (const auto &input : files) {
+        for (auto size : sizes) {
+            runOne(input, size, options, true, 0);
+            runOne(input, size, options, false, 0);
+        }
+    }
+
+    QTextStream out{&file};
+    out << "# file\tmax bytes read\tmax reads\tmax seeks\tmax allocations\n";
+    out << "# Recorded by pethumbnail-bench --record-budgets: the most each fixture needed, mapped or\n";
+    out << "# buffered, plus " << BUDGET_MARGIN_PERCENT << "% and at least " << ByteSource::BLOCK_SIZE << " bytes, "
+        << MIN_MARGIN_READS << " reads and seeks and " << MIN_MARGIN_ALLOCATIONS << " allocations.\n";
+    for (const auto &input : files) {
+        qint64 bytes = 0, allocs = 0;
+        int reads = 0, seeks = 0;
+        for (auto size : sizes) {
+            for (bool mmap : {true, false}) {
+                auto sample = runOne(input, size, options, mmap, 0);
+                bytes = qMax(bytes, sample.stats.io.bytesRead);
+                reads = qMax(reads, sample.stats.io.reads);
+                seeks = qMax(seeks, sample.stats.io.seeks);
+                allocs = qMax(allocs, sample.allocations);
+            }
+        }
+        out << QFileInfo{input}.fileName()
+            << '\t' << withMargin(bytes, ByteSource::BLOCK_SIZE)
+            << '\t' << withMargin(reads, MIN_MARGIN_READS)
+            << '\t' << withMargin(seeks, MIN_MARGIN_READS)
+            << '\t' << withMargin(allocs, qint64(MIN_MARGIN_ALLOCATIONS)) << '\n';
+    }
+    return true;
+}
+
+QHash<QString, FixtureBudget> loadBudgets(const QString &path) {
+    QHash<QString, FixtureBudget> budgets;
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("Unable to read %s", qPrintable(path));
+        return budgets;
+    }
+    while (!file.atEnd()) {
+        auto fields = QString::fromUtf8(file.readLine()).trimmed().split(QLatin1Char('\t'));
+        if (fields.size() != 5 || fields[0].startsWith(QLatin1Char('#'))) {
+            continue;
+        }
+        budgets.insert(fields[0], {fields[1].toLongLong(), fields[2].toInt(), fields[3].toInt(), fields[4].toInt()});
+    }
+    return budgets;
+}
+
+QString checkBudget(const Sample &sample, const FixtureBudget &budget) {
+    const auto &io = sample.stats.io;
+    QStringList exceeded;
+    if (io.bytesRead > budget.maxBytesRead) {
+        exceeded.append(QStringLiteral("bytes %1 > %2").arg(io.bytesRead).arg(budget.maxBytesRead));
+    }
+    if (io.reads > budget.maxReads) {
+        exceeded.append(QStringLiteral("reads %1 > %2").arg(io.reads).arg(budget.maxReads));
+    }
+    if (io.seeks > budget.maxSeeks) {
+        exceeded.append(QStringLiteral("seeks %1 > %2").arg(io.seeks).arg(budget.maxSeeks));
+    }
+    if (sample.allocations > budget.maxAllocations) {
+        exceeded.append(QStringLiteral("allocations %1 > %2").arg(sample.allocations).arg(budget.maxAllocations));
+    }
+    return exceeded.join(QStringLiteral(", "));
+}
+
+void printSummary(QTextStream &out, const QString &label, const Summary &summary) {
+    out << "  " << label.leftJustified(14)
+        << " n=" << summary.nsecs.size()
+        << " fail=" << summary.failures
+        << " p50=" << usecs(percentile(summary.nsecs, 50)) << "us"
+        << " p99=" << usecs(percentile(summary.nsecs, 99)) << "us"
+        << '\n';
+}
+
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication app{argc, argv};
+    QCoreApplication::setApplicationName(QStringLiteral("pethumbnail-bench"));
+    // Traces taken with PETHUMBNAIL_TRACE set include allocations too.
+    Trace::setAllocationCounter(&allocations);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Benchmarks Windows executable icon extraction over a directory tree."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("paths"), QStringLiteral("Files or directories to scan."), QStringLiteral("<path>..."));
+
+    QCommandLineOption sizesOption{{QStringLiteral("s"), QStringLiteral("sizes")},
+        QStringLiteral("Comma-separated target sizes (default: 48,128,256)."), QStringLiteral("sizes"), QStringLiteral("48,128,256")};
+    QCommandLineOption cacheOption{{QStringLiteral("c"), QStringLiteral("cache")},
+        QStringLiteral("Page cache passes to run: cold, warm or both (default: warm). "
+                       "Cold passes evict each file from the page cache before reading it."),
+        QStringLiteral("mode"), QStringLiteral("warm")};
+    QCommandLineOption perFileOption{QStringLiteral("per-file"), QStringLiteral("Print a line per file and size.")};
+    QCommandLineOption noMmapOption{QStringLiteral("no-mmap"), QStringLiteral("Read through the buffered path instead of mapping files.")};
+    QCommandLineOption noClassifyOption{QStringLiteral("no-classify"),
+        QStringLiteral("Parse DLLs, drivers and files without resources instead of rejecting them up front.")};
+    QCommandLineOption latencyOption{QStringLiteral("latency"),
+        QStringLiteral("Simulate a remote file by adding this many microseconds to every read and seek. Implies --no-mmap."),
+        QStringLiteral("usecs")};
+    QCommandLineOption noPoolOption{QStringLiteral("no-pool"),
+        QStringLiteral("Allocate every decoded image afresh instead of recycling pixel buffers.")};
+    QCommandLineOption budgetsOption{QStringLiteral("budgets"),
+        QStringLiteral("Fail if extractions exceed the budgets in this file, as written by --record-budgets."),
+        QStringLiteral("file")};
+    QCommandLineOption recordBudgetsOption{QStringLiteral("record-budgets"),
+        QStringLiteral("Measure every file mapped and buffered, and write what each needed plus a margin to this file as its budgets."),
+        QStringLiteral("file")};
+    parser.addOption(sizesOption);
+    parser.addOption(cacheOption);
+    parser.addOption(perFileOption);
+    parser.addOption(noMmapOption);
+    parser.addOption(noClassifyOption);
+    parser.addOption(latencyOption);
+    parser.addOption(noPoolOption);
+    parser.addOption(budgetsOption);
+    parser.addOption(recordBudgetsOption);
+    parser.process(app);
+
+    QVector<QSize> sizes;
+    for (const auto &value : parser.value(sizesOption).split(QLatin1Char(','))) {
+        bool ok = false;
+        int size = value.trimmed().toInt(&ok);
+        if (!ok || size <= 0) {
+            qWarning("Invalid target size: %s", qPrintable(value));
+            return 1;
+        }
+        sizes.append({size, size});
+    }
+
+    QStringList passes;
+    auto mode = parser.value(cacheOption);
+    if (mode == QLatin1String("cold") || mode == QLatin1String("both")) { passes.append(QStringLiteral("cold")); }
+    if (mode == QLatin1String("warm") || mode == QLatin1String("both")) { passes.append(QStringLiteral("warm")); }
+    if (passes.isEmpty()) {
+        qWarning("Invalid cache mode: %s", qPrintable(mode));
+        return 1;
+    }
+
+    QStringList files;
+    for (const auto &path : parser.positionalArguments()) {
+        if (QFileInfo{path}.isFile()) {
+            files.append(path);
+            continue;
+        }
+        QDirIterator it{path, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories};
+        while (it.hasNext()) {
+            files.append(it.next());
+        }
+    }
+    if (files.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    if (parser.isSet(recordBudgetsOption)) {
+        ExtractionOptions options;
+        options.classifier.enabled = !parser.isSet(noClassifyOption);
+        PixelPool pool;
+        options.pixelPool = parser.isSet(noPoolOption) ? nullptr : &pool;
+        return recordBudgets(parser.value(recordBudgetsOption), files, sizes, options) ? 0 : 1;
+    }
+
+    QHash<QString, FixtureBudget> budgets;
+    if (parser.isSet(budgetsOption)) {
+        budgets = loadBudgets(parser.value(budgetsOption));
+        if (budgets.isEmpty()) {
+            return 1;
+        }
+    }
+    QStringList violations;
+
+    QTextStream out{stdout};
+    bool perFile = parser.isSet(perFileOption);
+    ExtractionOptions options;
+    options.classifier.enabled = !parser.isSet(noClassifyOption);
+    int latencyUsecs = parser.value(latencyOption).toInt();
+    bool mmap = !parser.isSet(noMmapOption) && latencyUsecs <= 0;
+    if (perFile) {
+        out << "pass\tpath\ttarget\tusecs\tallocs\tbytes\treads\tseeks\tsaved\tformat\tkind\tbpp\ticon\trejected\n";
+    }
+
+    for (const auto &pass : passes) {
+        bool cold = pass == QLatin1String("cold");
+        PixelPool pool;
+        options.pixelPool = parser.isSet(noPoolOption) ? nullptr : &pool;
+
+        // Loading Qt's PNG plugin and filling the pool happen once per
+        // process, so they are kept out of the samples checked against the
+        // budgets.
+        if (!budgets.isEmpty()) {
+            for (const auto &path : files) {
+                for (auto size : sizes) {
+                    runOne(path, size, options, mmap, 0);
+                }
+            }
+        }
+        Summary total;
+        QMap<QString, Summary> byFormat, byKind, byBpp;
+        QMap<QString, int> rejected;
+        int overBudget = 0;
+
+        QElapsedTimer wall;
+        wall.start();
+        qint64 measured = 0;
+
+        for (const auto &path : files) {
+            for (auto size : sizes) {
+                if (cold) {
+                    dropFromPageCache(path);
+                }
+
+                auto sample = runOne(path, size, options, mmap, latencyUsecs);
+                measured += sample.nsecs;
+                total.add(sample);
+                byFormat[QString::fromLatin1(formatName(sample.stats.format))].add(sample);
+                byKind[iconKind(sample)].add(sample);
+                if (sample.stats.rejection != Rejection::None) {
+                    rejected[QString::fromLatin1(rejectionName(sample.stats.rejection))]++;
+                }
+                if (sample.stats.overBudget) {
+                    overBudget++;
+                }
+                if (sample.ok) {
+                    byBpp[QStringLiteral("%1bpp").arg(sample.stats.icon.bpp)].add(sample);
+                }
+
+                auto budget = budgets.constFind(QFileInfo{path}.fileName());
+                if (budget != budgets.constEnd()) {
+                    auto exceeded = checkBudget(sample, *budget);
+                    if (!exceeded.isEmpty()) {
+                        violations.append(QStringLiteral("%1 @%2 (%3): %4").arg(path).arg(size.width()).arg(pass, exceeded));
+                    }
+                }
+
+                if (perFile) {
+                    const auto &icon = sample.stats.icon;
+                    out << pass << '\t' << path << '\t' << size.width() << '\t' << usecs(sample.nsecs)
+                        << '\t' << sample.allocations << '\t' << sample.stats.io.bytesRead << '\t' << sample.stats.io.reads
+                        << '\t' << sample.stats.io.seeks << '\t' << sample.stats.io.readsSaved
+                        << '\t' << formatName(sample.stats.format)
+                        << '\t' << iconKind(sample) << '\t' << icon.bpp
+                        << '\t' << icon.size.width() << 'x' << icon.size.height()
+                        << '\t' << rejectionName(sample.stats.rejection) << '\n';
+                }
+            }
+        }
+
+        auto samples = total.nsecs.size();
+        out << pass << " pass: " << files.size() << " files, " << samples << " extractions, "
+            << total.failures << " failed\n";
+        out << "  latency: p50=" << usecs(percentile(total.nsecs, 50)) << "us"
+            << " p99=" << usecs(percentile(total.nsecs, 99)) << "us"
+            << " max=" << usecs(percentile(total.nsecs, 100)) << "us\n";
+        out << "  throughput: "
+            << QString::number(measured ? samples * 1e9 / double(measured) : 0.0, 'f', 1) << " files/s"
+            << " (wall " << QString::number(wall.elapsed() / 1000.0, 'f', 2) << "s)\n";
+        out << "  io: " << total.bytesRead << " bytes, " << total.reads << " reads, " << total.seeks << " seeks, "
+            << total.readsSaved << " reads saved"
+            << " (" << (samples ? total.bytesRead / samples : 0) << " bytes/file)\n";
+        out << "  allocations: p50=" << percentile(total.allocations, 50)
+            << " p99=" << percentile(total.allocations, 99)
+            << " max=" << percentile(total.allocations, 100) << " per file\n";
+        if (options.pixelPool) {
+            auto poolStats = pool.stats();
+            auto requests = poolStats.hits + poolStats.misses;
+            out << "  pixel pool: " << poolStats.hits << '/' << requests << " hits"
+                << " (" << QString::number(requests ? 100.0 * poolStats.hits / requests : 0.0, 'f', 1) << "%),"
+                << " peak " << poolStats.peakBytes / 1024 << " KiB\n";
+        }
+        if (!rejected.isEmpty()) {
+            out << "  rejected:";
+            for (auto it = rejected.cbegin(); it != rejected.cend(); ++it) {
+                out << ' ' << it.key() << '=' << it.value();
+            }
+            out << '\n';
+        }
+        if (overBudget) {
+            out << "  over parse limits: " << overBudget << '\n';
+        }
+        out << " by format:\n";
+        for (auto it = byFormat.cbegin(); it != byFormat.cend(); ++it) { printSummary(out, it.key(), it.value()); }
+        out << " by icon kind:\n";
+        for (auto it = byKind.cbegin(); it != byKind.cend(); ++it) { printSummary(out, it.key(), it.value()); }
+        out << " by bpp:\n";
+        for (auto it = byBpp.cbegin(); it != byBpp.cend(); ++it) { printSummary(out, it.key(), it.value()); }
+        out.flush();
+    }
+
+    if (!violations.isEmpty()) {
+        out << violations.size() << " extractions over budget:\n";
+        for (const auto &violation : violations) {
+            out << "  " << violation << '\n';
+        }
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <QtGlobal>
+
+// Caps on the work done for one file, so that corrupt or crafted headers
+// can't make the parser read, loop or allocate without bound. Running into
+// any of them fails the extraction.
+struct ParseLimits {
+    // Bytes viewed, counted separately for the parse and for each render.
+    qint64 maxBytesRead = 8 << 20;
+    // Sections, resource directory entries, NE resources and icon group
+    // entries, in total.
+    qint64 maxEntries = 16384;
+    // Pixels in any one icon, and in all the icons tried in one render.
+    qint64 maxPixels = 1024 * 1024;
+};
+
+// What one file has used of its limits. Once a limit is hit the budget stays
+// exhausted, and the parser gives up at its next check.
+class ParseBudget {
+public:
+    explicit ParseBudget(const ParseLimits &limits = {}) : caps{limits} {}
+
+    const ParseLimits &limits() const { return caps; }
+    bool exhausted() const { return spent; }
+
+    // Accounts for `count` more entries before they are read.
+    bool spendEntries(qint64 count) {
+        entries += qMax<qint64>(count, 0);
+        if (entries > caps.maxEntries) {
+            spent = true;
+        }
+        return !spent;
+    }
+
+    // Checks an icon's dimensions before anything is allocated for it. An
+    // empty icon is refused without touching the budget.
+    bool allowPixels(qint64 width, qint64 height) {
+        if (width <= 0 || height <= 0) {
+            return false;
+        }
+        if (width > caps.maxPixels / height) {
+            spent = true;
+        }
+        return !spent;
+    }
+
+private:
+    ParseLimits caps;
+    qint64 entries = 0;
+    bool spent = false;
+};
@@ -0,0 +1,149 @@
+#include "classify.h"
+
+#include "pe.h"
+#include "reader.h"
+
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+constexpr qint64 FIRST_PAGE_SIZE = 4096;
+
+constexpr quint16 IMAGE_FILE_SYSTEM = 0x1000;
+constexpr quint16 IMAGE_FILE_DLL = 0x2000;
+
+constexpr quint16 IMAGE_SUBSYSTEM_NATIVE = 1;
+constexpr quint16 IMAGE_SUBSYSTEM_EFI_BOOT_SERVICE_DRIVER = 11;
+constexpr quint16 IMAGE_SUBSYSTEM_EFI_RUNTIME_DRIVER = 12;
+
+constexpr int RESOURCE_DIRECTORY_INDEX = 2;
+
+constexpr quint16 NE_LIBRARY_MODULE = 0x8000;
+
+quint16 u16(const uchar *p) { return qFromLittleEndian<quint16>(p); }
+quint32 u32(const uchar *p) { return qFromLittleEndian<quint32>(p); }
+
+Classification classifyPortableExecutable(const uchar *pe, qint64 available, const ClassifierOptions &options) {
+    Classification result;
+
+    // Signature, file header and the start of the optional header.
+    if (available < 24 + 2) {
+        return result;
+    }
+    auto characteristics = u16(pe + 22);
+    auto optionalHeader = pe + 24;
+    auto optionalHeaderSize = qMin<qint64>(u16(pe + 20), available - 24);
+
+    bool plus;
+    switch (u16(optionalHeader)) {
+    case OPTIONAL_HEADER_MAGIC_PE32:
+        plus = false;
+        break;
+    case OPTIONAL_HEADER_MAGIC_PE32_PLUS:
+        plus = true;
+        break;
+    default:
+        return result;
+    }
+    result.format = plus ? ExeFormat::Pe32Plus : ExeFormat::Pe32;
+
+    if (options.rejectLibraries && (characteristics & IMAGE_FILE_DLL)) {
+        result.rejection = Rejection::Library;
+        return result;
+    }
+    if (options.rejectDrivers && (characteristics & IMAGE_FILE_SYSTEM)) {
+        result.rejection = Rejection::Driver;
+        return result;
+    }
+
+    if (optionalHeaderSize >= 70) {
+        auto subsystem = u16(optionalHeader + 68);
+        if (options.rejectDrivers && (subsystem == IMAGE_SUBSYSTEM_NATIVE ||
+                                      subsystem == IMAGE_SUBSYSTEM_EFI_BOOT_SERVICE_DRIVER ||
+                                      subsystem == IMAGE_SUBSYSTEM_EFI_RUNTIME_DRIVER)) {
+            result.rejection = Rejection::Driver;
+            return result;
+        }
+    }
+
+    qint64 numberOfRvaAndSizes = plus ? 108 : 92;
+    qint64 dataDirectories = numberOfRvaAndSizes + 4;
+    qint64 resourceDirectory = dataDirectories + RESOURCE_DIRECTORY_INDEX * 8;
+    if (options.rejectWithoutResources && optionalHeaderSize >= resourceDirectory + 8) {
+        if (u32(optionalHeader + numberOfRvaAndSizes) <= RESOURCE_DIRECTORY_INDEX ||
+            u32(optionalHeader + resourceDirectory) == 0 ||
+            u32(optionalHeader + resourceDirectory + 4) == 0) {
+            result.rejection = Rejection::NoResources;
+        }
+    }
+
+    return result;
+}
+
+Classification classifyNewExecutable(const uchar *ne, qint64 available, const ClassifierOptions &options) {
+    Classification result;
+    result.format = ExeFormat::Ne;
+
+    if (available < 0x28) {
+        return result;
+    }
+
+    if (options.rejectLibraries && (u16(ne + 0x0c) & NE_LIBRARY_MODULE)) {
+        result.rejection = Rejection::Library;
+        return result;
+    }
+
+    // The resource table runs up to the resident name table, so when both
+    // start at the same offset it is empty.
+    auto resourceTable = u16(ne + 0x24);
+    auto residentNameTable = u16(ne + 0x26);
+    if (options.rejectWithoutResources && resourceTable == residentNameTable) {
+        result.rejection = Rejection::NoResources;
+    }
+
+    return result;
+}
+
+}
+
+const char *rejectionName(Rejection rejection) {
+    switch (rejection) {
+    case Rejection::None: return "none";
+    case Rejection::NotExecutable: return "not-executable";
+    case Rejection::Library: return "library";
+    case Rejection::Driver: return "driver";
+    case Rejection::NoResources: return "no-resources";
+    }
+    return "unknown";
+}
+
+Classification classifyExecutable(ByteReader &reader, const ClassifierOptions &options) {
+    Classification result;
+
+    auto available = qMin(FIRST_PAGE_SIZE, reader.source().size());
+    auto page = reader.source().view(0, available);
+    if (!page || available < 0x40 || page[0] != 'M' || page[1] != 'Z') {
+        result.rejection = Rejection::NotExecutable;
+        return result;
+    }
+    if (!options.enabled) {
+        return result;
+    }
+
+    qint64 newHeaderOffset = u32(page + 0x3c);
+    if (newHeaderOffset < 0x40 || newHeaderOffset + 4 > available) {
+        return result;
+    }
+
+    auto header = page + newHeaderOffset;
+    available -= newHeaderOffset;
+    if (std::memcmp(header, "PE\0\0", 4) == 0) {
+        return classifyPortableExecutable(header, available, options);
+    }
+    if (header[0] == 'N' && header[1] == 'E') {
+        return classifyNewExecutable(header, available, options);
+    }
+    return result;
+}
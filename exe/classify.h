@@ -0,0 +1,37 @@
+#pragma once
+#include "common.h"
+
+#include <QtGlobal>
+
+class ByteReader;
+
+// Why a file was skipped without looking for an icon.
+enum class Rejection {
+    None,
+    NotExecutable,
+    Library,
+    Driver,
+    NoResources,
+};
+
+const char *rejectionName(Rejection rejection);
+
+// Which kinds of executables to skip. DLLs and drivers almost never carry a
+// meaningful icon, and files without a resource directory can't have one.
+struct ClassifierOptions {
+    bool enabled = true;
+    bool rejectLibraries = true;
+    bool rejectDrivers = true;
+    bool rejectWithoutResources = true;
+};
+
+struct Classification {
+    ExeFormat format = ExeFormat::Unknown;
+    Rejection rejection = Rejection::None;
+};
+
+// Classifies an executable using only its first page: the DOS header, the
+// PE file header, subsystem and resource data directory, or the NE header.
+// Anything that doesn't fit in the first page is given the benefit of the
+// doubt.
+Classification classifyExecutable(ByteReader &reader, const ClassifierOptions &options);
@@ -1,7 +1,15 @@
 #pragma once
+#include "arena.h"
+
 #include <QtGlobal>
 #include <QSize>
-#include <QVector>
+
+enum class ExeFormat {
+    Unknown,
+    Ne,
+    Pe32,
+    Pe32Plus,
+};
 
 struct ResourceId {
     quint32 ordinal;
@@ -12,7 +20,7 @@ struct ResourceDir {
         ResourceId id;
         quint32 dataOrSubdirOffset;
     };
-    QVector<Entry> entries;
+    ArenaVector<Entry> entries;
 };
 
 struct IconInfo {
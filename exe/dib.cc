@@ -1,80 +1,125 @@
 #include "dib.h"
 
+#include "dibline.h"
+#include "arena.h"
+#include "layout.h"
+#include "pixelpool.h"
+#include "reader.h"
+
 #include <QImage>
 
-#include <memory>
+#include <algorithm>
+#include <limits>
 
 namespace {
 
-struct DibScanner {
-    QRgb *colorTable;
-    int w, h;
+// Larger than any icon Windows can load.
+constexpr int MAX_DIMENSION = 32768;
 
-    using LineScanner = void (*)(DibScanner *s, uchar *in, QRgb *out);
+int dibStride(int w, int bpp) {
+    return (((w * bpp) + 31) & ~31) / 8;
+}
 
-    template<LineScanner ScanLine>
-    bool scan(QIODevice *in, uchar *out, int bpp, int outStride) {
-        int inStride = (((w * bpp) + 31) & ~31) / 8;
-        std::unique_ptr<uchar[]> buf{new uchar[inStride]};
-        for (int y = 0; y < h; y++) {
-            if (in->read(reinterpret_cast<char*>(buf.get()), inStride) != inStride) {
-                return false;
-            }
-            ScanLine(this, buf.get(), reinterpret_cast<QRgb *>(out));
-            out += outStride;
-        }
-        return true;
+// The XOR (color) and AND (mask) planes of an icon, addressed in image row
+// order regardless of whether the DIB is stored bottom-up.
+struct DibPlanes {
+    const uchar *color;
+    const uchar *mask;
+    int colorStride, maskStride;
+    int w, h;
+    bool bottomUp;
+
+    const uchar *colorRow(int y) const {
+        return color + qint64(bottomUp ? h - 1 - y : y) * colorStride;
+    }
+    const uchar *maskRow(int y) const {
+        return mask + qint64(bottomUp ? h - 1 - y : y) * maskStride;
     }
 };
 
-template<int bits>
-void indexedLine(DibScanner *s, uchar *in, QRgb *out) {
-    constexpr int fullByteMask = ~((8 / bits) - 1);
-    constexpr int pixelMask = (1 << bits) - 1;
-
-    int x = 0;
-    for (int n = s->w & fullByteMask; x < n; in++) {
-        for (int i = 8 - bits; i >= 0; i -= bits, x++) {
-            *out++ = s->colorTable[(*in >> i) & pixelMask];
+// Some 32 bpp icons leave the alpha channel zeroed and rely on the AND mask
+// for transparency. Stops at the first non-zero alpha, so icons that do carry
+// alpha only pay for a few bytes of this.
+bool hasAlphaChannel(const DibPlanes &planes) {
+    for (int y = 0; y < planes.h; y++) {
+        const uchar *row = planes.color + qint64(y) * planes.colorStride;
+        for (int x = 0; x < planes.w; x++) {
+            if (row[x * 4 + 3]) {
+                return true;
+            }
         }
     }
-    for (int i = 8 - bits; x < s->w; i -= bits, x++) {
-        *out++ = s->colorTable[(*in >> i) & pixelMask];
-    }
+    return false;
 }
 
-void bgr555Line(DibScanner *s, uchar *in, QRgb *out) {
-    for (int x = 0; x < s->w; x++, in += 2) {
-        int c = (in[0]) | (in[1] << 8);
-        *out++ = qRgb(
-            (c & 0b0'11111'00000'00000) >> 7,
-            (c & 0b0'00000'11111'00000) >> 2,
-            (c & 0b0'00000'00000'11111) << 3
-        );
+// Composes the color and mask planes row by row, straight into `image`.
+void compose(const DibPlanes &planes, const DibPalette *palette, DibLineFn scanLine, DibLineFn maskLine, QImage &image) {
+    for (int y = 0; y < planes.h; y++) {
+        auto out = reinterpret_cast<QRgb *>(image.scanLine(y));
+        scanLine(palette, planes.colorRow(y), out, planes.w);
+        maskLine(palette, planes.maskRow(y), out, planes.w);
     }
 }
 
-void bgr888Line(DibScanner *s, uchar *in, QRgb *out) {
-    for (int x = 0; x < s->w; x++, in += 3) {
-        *out++ = qRgb(in[2], in[1], in[0]);
-    }
-}
+// Like compose(), but downscales to the size of `image` in the same pass.
+// Every source pixel lands in exactly one output pixel, and each output
+// pixel is the premultiplied average of its box.
+void composeScaled(const DibPlanes &planes, const DibPalette *palette, DibLineFn scanLine, DibLineFn maskLine, QImage &image) {
+    int w = planes.w, h = planes.h;
+    int ow = image.width(), oh = image.height();
+
+    // The working rows fit on the stack for icons up to 256 px wide; only
+    // bigger ones go to the heap.
+    std::byte buffer[8 * 1024];
+    std::pmr::monotonic_buffer_resource scratch{buffer, sizeof(buffer)};
+
+    ArenaVector<int> column(w, &scratch);
+    ArenaVector<int> columnCount(ow, 0, &scratch);
+    for (int x = 0; x < w; x++) {
+        column[x] = x * ow / w;
+        columnCount[column[x]]++;
+    }
+
+    ArenaVector<QRgb> line(w, &scratch);
+    ArenaVector<quint32> sums(size_t(ow) * 4, 0, &scratch);
+    int row = -1, rowCount = 0;
+
+    auto flush = [&]() {
+        auto out = reinterpret_cast<QRgb *>(image.scanLine(row));
+        for (int x = 0; x < ow; x++) {
+            quint32 n = quint32(columnCount[x]) * rowCount;
+            quint32 *sum = &sums[x * 4];
+            out[x] = qRgba((sum[0] + n / 2) / n, (sum[1] + n / 2) / n, (sum[2] + n / 2) / n, (sum[3] + n / 2) / n);
+            sum[0] = sum[1] = sum[2] = sum[3] = 0;
+        }
+    };
 
-void bgra8888Line(DibScanner *s, uchar *in, QRgb *out) {
-    for (int x = 0; x < s->w; x++, in += 4) {
-        *out++ = qRgba(in[2], in[1], in[0], in[3]);
-    }
-}
+    for (int y = 0; y < h; y++) {
+        int outRow = y * oh / h;
+        if (outRow != row) {
+            if (row >= 0) {
+                flush();
+            }
+            row = outRow;
+            rowCount = 0;
+        }
+
+        scanLine(palette, planes.colorRow(y), line.data(), w);
+        maskLine(palette, planes.maskRow(y), line.data(), w);
 
-void maskLine(DibScanner *s, uchar *in, QRgb *out) {
-    int x = 0;
-    for (int n = s->w & ~7; x < n; in++) {
-        for (int i = 8 - 1; i >= 0; i--, x++, out++) {
-            if ((*in >> i) & 1) { *out = 0; }
+        for (int x = 0; x < w; x++) {
+            QRgb p = qPremultiply(line[x]);
+            quint32 *sum = &sums[column[x] * 4];
+            sum[0] += qRed(p);
+            sum[1] += qGreen(p);
+            sum[2] += qBlue(p);
+            sum[3] += qAlpha(p);
         }
+        rowCount++;
     }
-    for (int i = 7; x < s->w; i--, x++, out++) {
-        if ((*in >> i) & 1) { *out = 0; }
+
+    if (row >= 0) {
+        flush();
     }
 }
 
@@ -82,21 +127,30 @@ void maskLine(DibScanner *s, uchar *in, QRgb *out) {
 
 int BitmapInfoHeader::colorTableCount() const {
     if (biClrUsed > 0 && biClrUsed <= 256) { return biClrUsed; }
+    else if (biBitCount == 1) { return 2; }
     else if (biBitCount == 4) { return 16; }
     else if (biBitCount == 8) { return 256; }
     return 0;
 }
 
-QDataStream &operator>>(QDataStream &s, BitmapInfoHeader &v) {
-    s >> v.biSize >> v.biWidth >> v.biHeight
-      >> v.biPlanes >> v.biBitCount
-      >> v.biCompression >> v.biSizeImage
-      >> v.biXPelsPerMeter >> v.biYPelsPerMeter
-      >> v.biClrUsed >> v.biClrImportant;
-    return s;
+template<> struct LayoutOf<BitmapInfoHeader> : Layout<BitmapInfoHeader, 40,
+    Field<0, &BitmapInfoHeader::biSize>,
+    Field<4, &BitmapInfoHeader::biWidth>,
+    Field<8, &BitmapInfoHeader::biHeight>,
+    Field<12, &BitmapInfoHeader::biPlanes>,
+    Field<14, &BitmapInfoHeader::biBitCount>,
+    Field<16, &BitmapInfoHeader::biCompression>,
+    Field<20, &BitmapInfoHeader::biSizeImage>,
+    Field<24, &BitmapInfoHeader::biXPelsPerMeter>,
+    Field<28, &BitmapInfoHeader::biYPelsPerMeter>,
+    Field<32, &BitmapInfoHeader::biClrUsed>,
+    Field<36, &BitmapInfoHeader::biClrImportant>> {};
+
+ByteReader &operator>>(ByteReader &s, BitmapInfoHeader &v) {
+    return readStruct(s, v);
 }
 
-bool readIconDibBody(QDataStream &s, const BitmapInfoHeader &bi, QImage &image) {
+bool readIconDibBody(ByteReader &s, const BitmapInfoHeader &bi, QImage &image, QSize targetSize, PixelPool *pool) {
     // We only handle v3. Maybe *very* old executables have older DIBs?
     if (bi.biSize != 40) {
         return false;
@@ -107,61 +161,77 @@ bool readIconDibBody(QDataStream &s, const BitmapInfoHeader &bi, QImage &image)
         return false;
     }
 
-    QIODevice *in = s.device();
     int w = bi.biWidth, h = bi.biHeight, colors = bi.colorTableCount(), bpp = bi.biBitCount;
 
     // Top-down DIB
     if (h < 0) {
-        h = -h;
+        h = h == std::numeric_limits<int>::min() ? 0 : -h;
     }
 
     // Icons have the height set to double to store the AND mask.
     h /= 2;
 
-    image = QImage{w, h, QImage::Format_ARGB32};
-    if (image.isNull()) {
+    // Anything bigger is corrupt, and would overflow the stride.
+    if (w <= 0 || h <= 0 || w > MAX_DIMENSION || h > MAX_DIMENSION) {
         return false;
     }
 
-    image.setDotsPerMeterX(bi.biXPelsPerMeter);
-    image.setDotsPerMeterY(bi.biYPelsPerMeter);
+    const auto &kernels = dibLineKernels();
+    auto scanLine = kernels.forBpp(bpp);
+    if (!scanLine) {
+        return false;
+    }
 
     // Load color table.
-    QRgb colorTable[256] = {
-        qRgb(0x00, 0x00, 0x00),
-        qRgb(0xFF, 0xFF, 0xFF),
-    };
-    quint8 rgb[4];
-    for (int i = 0; i < colors; i++) {
-        if (in->read((char *)rgb, sizeof(rgb)) != sizeof(rgb)) {
-            return false;
-        }
-        colorTable[i] = qRgb(rgb[2], rgb[1], rgb[0]);
+    DibPalette palette;
+    palette.colors[0] = qRgb(0x00, 0x00, 0x00);
+    palette.colors[1] = qRgb(0xFF, 0xFF, 0xFF);
+    std::fill(palette.colors + 2, palette.colors + 256, 0);
+    auto rgb = s.read(colors * 4);
+    if (!rgb) {
+        return false;
+    }
+    for (int i = 0; i < colors; i++, rgb += 4) {
+        palette.colors[i] = qRgb(rgb[2], rgb[1], rgb[0]);
     }
+    palette.buildTables(bpp);
 
-    uchar *out = image.bits();
-    int outStride = image.bytesPerLine();
+    // Fetch both planes at once; this is a zero-copy view when the file is
+    // mapped and a single read otherwise. This comes before the image is
+    // allocated, so a header that claims more pixels than the data holds
+    // costs nothing.
+    DibPlanes planes{nullptr, nullptr, dibStride(w, bpp), dibStride(w, 1), w, h, bi.biHeight > 0};
+    auto bits = s.read((qint64(planes.colorStride) + planes.maskStride) * h);
+    if (!bits) {
+        return false;
+    }
+    planes.color = bits;
+    planes.mask = bits + qint64(planes.colorStride) * h;
 
-    // Bottom-up DIB: scan from last line up.
-    if (bi.biHeight > 0) {
-        out += outStride * (h - 1);
-        outStride = -outStride;
+    // Icons bigger than the target are downscaled while decoding, straight
+    // into a premultiplied image of the final size.
+    bool scaled = targetSize.isValid() && (w > targetSize.width() || h > targetSize.height());
+    if (scaled) {
+        auto size = QSize{w, h}.scaled(targetSize, Qt::KeepAspectRatio).expandedTo({1, 1});
+        image = allocateImage(pool, size, QImage::Format_ARGB32_Premultiplied);
+    } else {
+        image = allocateImage(pool, QSize{w, h}, QImage::Format_ARGB32);
+    }
+    if (image.isNull()) {
+        return false;
     }
 
-    // Scan in XOR mask/main DIB image
-    DibScanner scanner{colorTable, w, h};
-    switch (bi.biBitCount) {
-        case  1: if (!scanner.scan<indexedLine<1>>(in, out, bpp, outStride)) return false; break;
-        case  4: if (!scanner.scan<indexedLine<4>>(in, out, bpp, outStride)) return false; break;
-        case  8: if (!scanner.scan<indexedLine<8>>(in, out, bpp, outStride)) return false; break;
-        case 16: if (!scanner.scan<bgr555Line    >(in, out, bpp, outStride)) return false; break;
-        case 24: if (!scanner.scan<bgr888Line    >(in, out, bpp, outStride)) return false; break;
-        case 32: if (!scanner.scan<bgra8888Line  >(in, out, bpp, outStride)) return false; break;
+    image.setDotsPerMeterX(bi.biXPelsPerMeter);
+    image.setDotsPerMeterY(bi.biYPelsPerMeter);
+
+    if (bpp == 32 && !hasAlphaChannel(planes)) {
+        scanLine = kernels.bgrx8888;
     }
 
-    // Scan in AND mask
-    if (!scanner.scan<maskLine>(in, out, 1, outStride)) {
-        return false;
+    if (scaled) {
+        composeScaled(planes, &palette, scanLine, kernels.mask, image);
+    } else {
+        compose(planes, &palette, scanLine, kernels.mask, image);
     }
 
     return true;
@@ -1,7 +1,9 @@
 #pragma once
 #include <QtGlobal>
+#include <QSize>
 
-class QDataStream;
+class ByteReader;
+class PixelPool;
 class QImage;
 
 struct BitmapInfoHeader {
@@ -20,5 +22,10 @@ struct BitmapInfoHeader {
     int colorTableCount() const;
 };
 
-QDataStream &operator>>(QDataStream &s, BitmapInfoHeader &v);
-bool readIconDibBody(QDataStream &s, const BitmapInfoHeader &bi, QImage &image);
+ByteReader &operator>>(ByteReader &s, BitmapInfoHeader &v);
+
+// Decodes the XOR and AND planes of an icon DIB. If `targetSize` is valid and
+// the icon doesn't fit in it, the icon is downscaled to fit while decoding.
+// The image's pixels come from `pool` if one is given.
+bool readIconDibBody(ByteReader &s, const BitmapInfoHeader &bi, QImage &image, QSize targetSize = QSize(),
+                     PixelPool *pool = nullptr);
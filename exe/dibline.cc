@@ -0,0 +1,395 @@
+#include "dibline.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIBLINE_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define DIBLINE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Scalar reference implementations.
+
+template<int bits>
+void indexedLine(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    constexpr int fullByteMask = ~((8 / bits) - 1);
+    constexpr int pixelMask = (1 << bits) - 1;
+
+    int x = 0;
+    for (int n = w & fullByteMask; x < n; in++) {
+        for (int i = 8 - bits; i >= 0; i -= bits, x++) {
+            *out++ = palette->colors[(*in >> i) & pixelMask];
+        }
+    }
+    for (int i = 8 - bits; x < w; i -= bits, x++) {
+        *out++ = palette->colors[(*in >> i) & pixelMask];
+    }
+}
+
+void bgr555Line(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    for (int x = 0; x < w; x++, in += 2) {
+        int c = (in[0]) | (in[1] << 8);
+        *out++ = qRgb(
+            (c & 0b0'11111'00000'00000) >> 7,
+            (c & 0b0'00000'11111'00000) >> 2,
+            (c & 0b0'00000'00000'11111) << 3
+        );
+    }
+}
+
+void bgr888Line(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    for (int x = 0; x < w; x++, in += 3) {
+        *out++ = qRgb(in[2], in[1], in[0]);
+    }
+}
+
+void bgra8888Line(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    for (int x = 0; x < w; x++, in += 4) {
+        *out++ = qRgba(in[2], in[1], in[0], in[3]);
+    }
+}
+
+void bgrx8888Line(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    for (int x = 0; x < w; x++, in += 4) {
+        *out++ = qRgb(in[2], in[1], in[0]);
+    }
+}
+
+void maskLine(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    int x = 0;
+    for (int n = w & ~7; x < n; in++) {
+        for (int i = 8 - 1; i >= 0; i--, x++, out++) {
+            if ((*in >> i) & 1) { *out = 0; }
+        }
+    }
+    for (int i = 7; x < w; i--, x++, out++) {
+        if ((*in >> i) & 1) { *out = 0; }
+    }
+}
+
+// Portable table-driven and byte-at-a-time variants.
+
+void indexed1Table(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in++) {
+        std::memcpy(out + x, palette->nibble1[*in >> 4], sizeof(palette->nibble1[0]));
+        std::memcpy(out + x + 4, palette->nibble1[*in & 0xf], sizeof(palette->nibble1[0]));
+    }
+    indexedLine<1>(palette, in, out + x, w - x);
+}
+
+void indexed4Table(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    int x = 0;
+    for (; x + 2 <= w; x += 2, in++) {
+        std::memcpy(out + x, palette->byte4[*in], sizeof(palette->byte4[0]));
+    }
+    indexedLine<4>(palette, in, out + x, w - x);
+}
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+// QRgb is 0xAARRGGBB, which is B, G, R, A in memory: the same as the DIB.
+void bgra8888Copy(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    std::memcpy(out, in, size_t(w) * sizeof(QRgb));
+}
+
+// Simple enough for the compiler to vectorize on its own.
+void bgrx8888Words(const DibPalette *, const uchar *in, QRgb *out, int w) {
+    std::memcpy(out, in, size_t(w) * sizeof(QRgb));
+    for (int x = 0; x < w; x++) {
+        out[x] |= 0xff000000;
+    }
+}
+#endif
+
+// Skips fully opaque bytes and clears fully transparent ones in one go, which
+// covers the vast majority of mask bytes in real icons.
+void maskLineBytes(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in++) {
+        if (*in == 0x00) {
+            continue;
+        }
+        if (*in == 0xff) {
+            std::memset(out + x, 0, 8 * sizeof(QRgb));
+            continue;
+        }
+        maskLine(palette, in, out + x, 8);
+    }
+    maskLine(palette, in, out + x, w - x);
+}
+
+#if DIBLINE_X86
+
+__attribute__((target("sse2")))
+void maskLineSse2(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const __m128i bitsLo = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+    const __m128i bitsHi = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in++) {
+        if (*in == 0x00) {
+            continue;
+        }
+        auto p = reinterpret_cast<__m128i *>(out + x);
+        __m128i m = _mm_set1_epi32(*in);
+        __m128i keepLo = _mm_cmpeq_epi32(_mm_and_si128(m, bitsLo), zero);
+        __m128i keepHi = _mm_cmpeq_epi32(_mm_and_si128(m, bitsHi), zero);
+        _mm_storeu_si128(p, _mm_and_si128(_mm_loadu_si128(p), keepLo));
+        _mm_storeu_si128(p + 1, _mm_and_si128(_mm_loadu_si128(p + 1), keepHi));
+    }
+    maskLine(palette, in, out + x, w - x);
+}
+
+// Spreads the three 5-bit fields of eight pixels into the bytes of their
+// 32-bit words, scaled up by 8 like the scalar version.
+__attribute__((target("sse2")))
+void bgr555LineSse2(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i red = _mm_set1_epi32(0x00f80000);
+    const __m128i green = _mm_set1_epi32(0x0000f800);
+    const __m128i blue = _mm_set1_epi32(0x000000f8);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+
+    auto expand = [&](__m128i c) {
+        __m128i v = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(c, 9), red), _mm_and_si128(_mm_slli_epi32(c, 6), green));
+        return _mm_or_si128(_mm_or_si128(v, _mm_and_si128(_mm_slli_epi32(c, 3), blue)), alpha);
+    };
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), expand(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x + 4), expand(_mm_unpackhi_epi16(v, zero)));
+    }
+    bgr555Line(palette, in, out + x, w - x);
+}
+
+__attribute__((target("ssse3")))
+void bgr888LineSsse3(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000));
+
+    // Each load reads 16 bytes but only consumes 12; stop while a full load
+    // still fits inside the line.
+    int x = 0;
+    for (; x + 6 <= w; x += 4, in += 12) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), v);
+    }
+    bgr888Line(palette, in, out + x, w - x);
+}
+
+__attribute__((target("avx2")))
+void bgr888LineAvx2(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+
+    // Same over-read rule as the SSSE3 version; the second lane's load ends
+    // 28 bytes into the block.
+    int x = 0;
+    for (; x + 10 <= w; x += 8, in += 24) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), v);
+    }
+    bgr888LineSsse3(palette, in, out + x, w - x);
+}
+
+__attribute__((target("avx2")))
+void bgr555LineAvx2(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const __m256i red = _mm256_set1_epi32(0x00f80000);
+    const __m256i green = _mm256_set1_epi32(0x0000f800);
+    const __m256i blue = _mm256_set1_epi32(0x000000f8);
+    const __m256i alpha = _mm256_set1_epi32(int(0xff000000));
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in += 16) {
+        __m256i c = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)));
+        __m256i v = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(c, 9), red),
+                                    _mm256_and_si256(_mm256_slli_epi32(c, 6), green));
+        v = _mm256_or_si256(_mm256_or_si256(v, _mm256_and_si256(_mm256_slli_epi32(c, 3), blue)), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), v);
+    }
+    bgr555LineSse2(palette, in, out + x, w - x);
+}
+
+// Eight palette lookups per gather. Before AVX2 there is no gather, and the
+// scalar loop is as good as it gets.
+__attribute__((target("avx2")))
+void indexed8LineAvx2(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    auto colors = reinterpret_cast<const int *>(palette->colors);
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + x), _mm256_i32gather_epi32(colors, index, 4));
+    }
+    indexedLine<8>(palette, in, out + x, w - x);
+}
+
+#endif
+
+#if DIBLINE_NEON
+
+void bgr888LineNeon(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    int x = 0;
+    for (; x + 16 <= w; x += 16, in += 48) {
+        uint8x16x3_t bgr = vld3q_u8(in);
+        uint8x16x4_t bgra = {{bgr.val[0], bgr.val[1], bgr.val[2], vdupq_n_u8(0xff)}};
+        vst4q_u8(reinterpret_cast<uint8_t *>(out + x), bgra);
+    }
+    bgr888Line(palette, in, out + x, w - x);
+}
+
+void bgr555LineNeon(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const uint32x4_t red = vdupq_n_u32(0x00f80000);
+    const uint32x4_t green = vdupq_n_u32(0x0000f800);
+    const uint32x4_t blue = vdupq_n_u32(0x000000f8);
+    const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+
+    auto expand = [&](uint32x4_t c) {
+        uint32x4_t v = vorrq_u32(vandq_u32(vshlq_n_u32(c, 9), red), vandq_u32(vshlq_n_u32(c, 6), green));
+        return vorrq_u32(vorrq_u32(v, vandq_u32(vshlq_n_u32(c, 3), blue)), alpha);
+    };
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in += 16) {
+        uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t *>(in));
+        auto p = reinterpret_cast<uint32_t *>(out + x);
+        vst1q_u32(p, expand(vmovl_u16(vget_low_u16(v))));
+        vst1q_u32(p + 4, expand(vmovl_u16(vget_high_u16(v))));
+    }
+    bgr555Line(palette, in, out + x, w - x);
+}
+
+void maskLineNeon(const DibPalette *palette, const uchar *in, QRgb *out, int w) {
+    const uint32x4_t bitsLo = {0x80, 0x40, 0x20, 0x10};
+    const uint32x4_t bitsHi = {0x08, 0x04, 0x02, 0x01};
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8, in++) {
+        if (*in == 0x00) {
+            continue;
+        }
+        auto p = reinterpret_cast<uint32_t *>(out + x);
+        uint32x4_t m = vdupq_n_u32(*in);
+        vst1q_u32(p, vbicq_u32(vld1q_u32(p), vtstq_u32(m, bitsLo)));
+        vst1q_u32(p + 4, vbicq_u32(vld1q_u32(p + 4), vtstq_u32(m, bitsHi)));
+    }
+    maskLine(palette, in, out + x, w - x);
+}
+
+#endif
+
+// Each level adds to the one before, so every set the CPU supports can be
+// checked against the scalar one. indexed1 and indexed4 are table lookups
+// at every level, and indexed8 gets a vector path only where there is a
+// gather (AVX2); on SSE2, SSSE3 and NEON it stays a scalar loop on purpose,
+// since a palette lookup per pixel can't be done with shuffles.
+QVector<DibLineKernels> detectKernels() {
+    QVector<DibLineKernels> levels;
+
+    DibLineKernels kernels = scalarDibLineKernels();
+    kernels.name = "table";
+    kernels.indexed1 = indexed1Table;
+    kernels.indexed4 = indexed4Table;
+    kernels.mask = maskLineBytes;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    kernels.bgra8888 = bgra8888Copy;
+    kernels.bgrx8888 = bgrx8888Words;
+#endif
+    levels.append(kernels);
+
+#if DIBLINE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.name = "sse2";
+        kernels.mask = maskLineSse2;
+        kernels.bgr555 = bgr555LineSse2;
+        levels.append(kernels);
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        kernels.name = "ssse3";
+        kernels.bgr888 = bgr888LineSsse3;
+        levels.append(kernels);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.name = "avx2";
+        kernels.bgr888 = bgr888LineAvx2;
+        kernels.bgr555 = bgr555LineAvx2;
+        kernels.indexed8 = indexed8LineAvx2;
+        levels.append(kernels);
+    }
+#elif DIBLINE_NEON
+    kernels.name = "neon";
+    kernels.bgr888 = bgr888LineNeon;
+    kernels.bgr555 = bgr555LineNeon;
+    kernels.mask = maskLineNeon;
+    levels.append(kernels);
+#endif
+
+    return levels;
+}
+
+}
+
+void DibPalette::buildTables(int bpp) {
+    if (bpp == 1) {
+        for (int n = 0; n < 16; n++) {
+            for (int i = 0; i < 4; i++) {
+                nibble1[n][i] = colors[(n >> (3 - i)) & 1];
+            }
+        }
+    } else if (bpp == 4) {
+        for (int b = 0; b < 256; b++) {
+            byte4[b][0] = colors[b >> 4];
+            byte4[b][1] = colors[b & 0xf];
+        }
+    }
+}
+
+DibLineFn DibLineKernels::forBpp(int bpp) const {
+    switch (bpp) {
+        case  1: return indexed1;
+        case  4: return indexed4;
+        case  8: return indexed8;
+        case 16: return bgr555;
+        case 24: return bgr888;
+        case 32: return bgra8888;
+    }
+    return nullptr;
+}
+
+const DibLineKernels &scalarDibLineKernels() {
+    static const DibLineKernels kernels{
+        "scalar",
+        indexedLine<1>,
+        indexedLine<4>,
+        indexedLine<8>,
+        bgr555Line,
+        bgr888Line,
+        bgra8888Line,
+        bgrx8888Line,
+        maskLine,
+    };
+    return kernels;
+}
+
+const QVector<DibLineKernels> &supportedDibLineKernels() {
+    static const QVector<DibLineKernels> levels = detectKernels();
+    return levels;
+}
+
+const DibLineKernels &dibLineKernels() {
+    return supportedDibLineKernels().last();
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <QtGlobal>
+#include <QColor>
+#include <QVector>
+
+// Color table for indexed DIBs, plus lookup tables that expand a whole input
+// byte (or nibble) into several pixels at once.
+struct DibPalette {
+    QRgb colors[256];
+    QRgb nibble1[16][4];
+    QRgb byte4[256][2];
+
+    // Fills in the expansion table used for the given bit depth.
+    void buildTables(int bpp);
+};
+
+// Converts one scanline of `w` pixels. `palette` is only used by indexed
+// formats. bgrx8888 is 32 bpp with the alpha byte ignored, for icons that
+// rely on the AND mask alone. The mask converter clears the pixels whose AND
+// mask bit is set.
+using DibLineFn = void (*)(const DibPalette *palette, const uchar *in, QRgb *out, int w);
+
+struct DibLineKernels {
+    const char *name;
+    DibLineFn indexed1;
+    DibLineFn indexed4;
+    DibLineFn indexed8;
+    DibLineFn bgr555;
+    DibLineFn bgr888;
+    DibLineFn bgra8888;
+    DibLineFn bgrx8888;
+    DibLineFn mask;
+
+    DibLineFn forBpp(int bpp) const;
+};
+
+// Portable one-pixel-at-a-time converters; the reference that every other
+// implementation must match bit for bit.
+const DibLineKernels &scalarDibLineKernels();
+
+// Every set of converters the running CPU supports, from the portable
+// table-driven one up to the fastest, so that tests can check each of them.
+const QVector<DibLineKernels> &supportedDibLineKernels();
+
+// The fastest converters supported by the running CPU.
+const DibLineKernels &dibLineKernels();
@@ -0,0 +1,97 @@
+// Checks that every set of scanline converters the running CPU supports,
+// not just the fastest, produces exactly the same pixels as the scalar
+// reference, for every width up to 300 so that each SIMD tail length comes
+// up. Checking the lower levels too covers the SSSE3 and SSE2 code that the
+// AVX2 converters hand their tails to.
+
+#include "dibline.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr int MAX_WIDTH = 300;
+constexpr int ROUNDS = 4;
+
+struct Slot {
+    const char *name;
+    DibLineFn DibLineKernels::*convert;
+    int bpp;
+};
+
+const Slot SLOTS[] = {
+    {"indexed1", &DibLineKernels::indexed1, 1},
+    {"indexed4", &DibLineKernels::indexed4, 4},
+    {"indexed8", &DibLineKernels::indexed8, 8},
+    {"bgr555", &DibLineKernels::bgr555, 16},
+    {"bgr888", &DibLineKernels::bgr888, 24},
+    {"bgra8888", &DibLineKernels::bgra8888, 32},
+    {"bgrx8888", &DibLineKernels::bgrx8888, 32},
+    {"mask", &DibLineKernels::mask, 1},
+};
+
+// Returns the number of converters that differ from the reference.
+int compare(const DibLineKernels &reference, const DibLineKernels &fast) {
+    std::printf("comparing %s against %s\n", fast.name, reference.name);
+
+    std::mt19937 random{20240501};
+    auto byte = [&] { return uchar(random()); };
+
+    int failures = 0;
+    for (const auto &slot : SLOTS) {
+        DibPalette palette;
+        for (auto &color : palette.colors) {
+            color = QRgb(random());
+        }
+        palette.buildTables(slot.bpp);
+
+        for (int w = 1; w <= MAX_WIDTH; w++) {
+            for (int round = 0; round < ROUNDS; round++) {
+                // Exactly as long as the line, so that a sanitizer build
+                // catches converters reading past it.
+                std::vector<uchar> in((w * slot.bpp + 7) / 8);
+                for (auto &b : in) {
+                    b = byte();
+                }
+                // Both outputs start out the same, so pixels one of them
+                // fails to write (or the mask fails to keep) show up too.
+                std::vector<QRgb> expected(w);
+                for (auto &pixel : expected) {
+                    pixel = QRgb(random());
+                }
+                auto actual = expected;
+
+                (reference.*slot.convert)(&palette, in.data(), expected.data(), w);
+                (fast.*slot.convert)(&palette, in.data(), actual.data(), w);
+
+                if (std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(QRgb)) != 0) {
+                    std::printf("FAIL %s/%s width %d\n", fast.name, slot.name, w);
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+
+    return failures;
+}
+
+}
+
+int main() {
+    const auto &reference = scalarDibLineKernels();
+    int failures = 0;
+    for (const auto &kernels : supportedDibLineKernels()) {
+        failures += compare(reference, kernels);
+    }
+
+    if (failures) {
+        std::printf("%d mismatches\n", failures);
+        return 1;
+    }
+    std::printf("all converters match\n");
+    return 0;
+}
@@ -1,10 +1,12 @@
 #include "exe.h"
 
-#include <QDataStream>
+#include "layout.h"
+#include "reader.h"
 
-QDataStream &operator>>(QDataStream &s, DosHeader &v) {
-    s.readRawData(v.signature, sizeof(v.signature));
-    s.device()->skip(58);
-    s >> v.newHeaderOffset;
-    return s;
+template<> struct LayoutOf<DosHeader> : Layout<DosHeader, 64,
+    Field<0x00, &DosHeader::signature>,
+    Field<0x3c, &DosHeader::newHeaderOffset>> {};
+
+ByteReader &operator>>(ByteReader &s, DosHeader &v) {
+    return readStruct(s, v);
 }
@@ -1,11 +1,11 @@
 #pragma once
 #include <QtGlobal>
 
-class QDataStream;
+class ByteReader;
 
 struct DosHeader {
     char signature[2];
     quint32 newHeaderOffset;
 };
 
-QDataStream &operator>>(QDataStream &s, DosHeader &v);
+ByteReader &operator>>(ByteReader &s, DosHeader &v);
@@ -0,0 +1,342 @@
+#include "exeicons.h"
+#include "dib.h"
+#include "iconcache.h"
+#include "pixelpool.h"
+#include "png.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// Variants tried per render before giving up. Group entries are cheap to
+// forge, and each failed attempt may cost a full read and decode.
+constexpr int MAX_RENDER_ATTEMPTS = 4;
+
+QImage decodeIcon(const uchar *data, IconInfo info, QSize targetSize, PixelPool *pool) {
+    if (info.png) {
+        QImage image;
+        if (!decodePng(data, info.dataLength, image, targetSize, pool)) {
+            return {};
+        }
+        return image;
+    }
+
+    ByteSource iconSource{data, info.dataLength};
+    ByteReader icon{&iconSource};
+
+    BitmapInfoHeader header;
+    icon >> header;
+
+    QImage image;
+    if (!readIconDibBody(icon, header, image, targetSize, pool)) {
+        return {};
+    }
+
+    return image;
+}
+
+// Ranks a variant against the target size using only what the group
+// directory says (and the icon header, for variants that don't give their
+// depth). Lower costs are better. Being too small costs the most, since
+// upscaling blurs; being too big costs a little, for the bigger read and
+// the downscale. Both are relative to the size, so that they weigh against
+// the depth the same way at any target: a 256 px request prefers a 256x256
+// 24-bit icon to a 16x16 32-bit one, while a 48x48 8-bit icon still beats a
+// 256x256 32-bit one for 48 px. Among equal costs the one with fewer bytes
+// to read and decode wins.
+struct IconScore {
+    qint64 cost;
+    quint32 bytes;
+
+    IconScore(const ExecutableIcons::Variant &variant, QSize targetSize) {
+        qint64 size = qMax(variant.size.width(), 1);
+        qint64 target = qMax(targetSize.width(), 1);
+        cost = size >= target ? (size - target) * 16 / target : (target - size) * 200 / size;
+        cost += depthCost(variant.bpp);
+        bytes = variant.bytes;
+    }
+
+    static int depthCost(int bpp) {
+        if (bpp >= 32) { return 0; }
+        if (bpp >= 24) { return 10; }
+        if (bpp >= 16) { return 40; }
+        if (bpp >= 8) { return 60; }
+        if (bpp >= 4) { return 150; }
+        if (bpp >= 1) { return 250; }
+        return 300;
+    }
+
+    bool operator<(const IconScore &other) const {
+        if (cost != other.cost) { return cost < other.cost; }
+        return bytes < other.bytes;
+    }
+};
+
+}
+
+ExecutableIcons::ExecutableIcons(QIODevice *file, const ExtractionOptions &options)
+    : options{options}, source{file}, reader{&source}
+{
+    parse();
+}
+
+ExecutableIcons::ExecutableIcons(std::unique_ptr<QIODevice> file, const ExtractionOptions &options)
+    : ExecutableIcons{file.get(), options}
+{
+    owned = std::move(file);
+}
+
+ExecutableIcons::~ExecutableIcons() {
+    if (auto trace = Trace::current()) {
+        trace->detach(&source);
+    }
+}
+
+void ExecutableIcons::parse() {
+    source.setReadBudget(options.limits.maxBytesRead);
+    if (auto trace = Trace::current()) {
+        trace->attach(&source);
+    }
+
+    // Skip DLLs, drivers and the like before parsing anything; this also
+    // verifies the MZ header.
+    {
+        TraceSpan span{"classify"};
+        auto classification = classifyExecutable(reader, options.classifier);
+        exeFormat = classification.format;
+        rejected = classification.rejection;
+        if (rejected != Rejection::None) {
+            return;
+        }
+    }
+
+    // Read DOS header.
+    DosHeader dosHeader;
+    reader >> dosHeader;
+
+    {
+        TraceSpan span{"headers"};
+        pe.emplace(&reader, dosHeader, &budget, arena.resource());
+        if (pe->parseHeaders()) {
+            exeFormat = pe->isPe32Plus() ? ExeFormat::Pe32Plus : ExeFormat::Pe32;
+        } else {
+            pe.reset();
+            ne.emplace(&reader, dosHeader, &budget, arena.resource());
+            if (!ne->parseHeaders()) {
+                ne.reset();
+                return;
+            }
+            exeFormat = ExeFormat::Ne;
+        }
+    }
+
+    {
+        TraceSpan span{"group"};
+        entries = pe ? pe->readMainIconGroup() : ne->readMainIconGroup();
+    }
+
+    // Whatever was parsed before running out can't be trusted to be complete.
+    if (overBudget()) {
+        entries.clear();
+        return;
+    }
+
+    variantList.reserve(entries.size());
+    for (const auto &entry : entries) {
+        variantList.push_back({groupEntrySize(entry), groupEntryBpp(entry), entry.size});
+    }
+    probed.resize(entries.size());
+}
+
+bool ExecutableIcons::probe(int variant, IconInfo &info) {
+    auto &cached = probed[variant];
+    if (!cached) {
+        IconInfo probedInfo;
+        bool ok = pe ? pe->getIconInfo(entries[variant], probedInfo)
+                     : ne && ne->getIconInfo(entries[variant], probedInfo);
+        if (!ok) {
+            probedInfo.dataOffset = 0;
+        }
+        cached = probedInfo;
+    }
+    info = *cached;
+    return info.dataOffset != 0;
+}
+
+// Variants whose group entry leaves the depth out (PNG ones, mostly) would
+// otherwise rank below every palette icon, so their headers are read first.
+// That is a small peek per such variant, and the probe is kept for when the
+// variant is rendered.
+void ExecutableIcons::resolveUnknownDepths() {
+    for (int i = 0; i < int(variantList.size()); i++) {
+        IconInfo info;
+        if (!variantList[i].bpp && !overBudget() && probe(i, info)) {
+            variantList[i].bpp = info.bpp;
+        }
+    }
+}
+
+bool ExecutableIcons::overBudget() const {
+    return budget.exhausted() || source.overReadBudget() || pixelsLeft < 0;
+}
+
+void ExecutableIcons::beginRender() {
+    source.setReadBudget(options.limits.maxBytesRead);
+    pixelsLeft = options.limits.maxPixels;
+}
+
+QImage ExecutableIcons::render(int variant, QSize targetSize, ExtractionStats *stats) {
+    beginRender();
+    return finishRender(renderVariant(variant, targetSize, stats), stats);
+}
+
+QImage ExecutableIcons::renderVariant(int variant, QSize targetSize, ExtractionStats *stats) {
+    if (variant < 0 || variant >= int(entries.size()) || overBudget()) {
+        return {};
+    }
+    auto trace = Trace::current();
+    if (trace) {
+        trace->attach(&source);
+    }
+
+    IconInfo info;
+    {
+        TraceSpan span{"probe"};
+        if (!probe(variant, info) || !reader.seek(info.dataOffset)) {
+            return {};
+        }
+    }
+
+    // Every attempt in a render draws on the same pixel allowance, so a
+    // group of entries pointing at one broken icon can't have it decoded
+    // over and over.
+    pixelsLeft -= qint64(info.size.width()) * qAbs(qint64(info.size.height()));
+    if (pixelsLeft < 0) {
+        return {};
+    }
+
+    // Fetch the whole icon with one read (or none, when mapped) and decode it
+    // from memory.
+    const uchar *data;
+    {
+        TraceSpan span{"read"};
+        data = reader.read(info.dataLength);
+        if (!data) {
+            return {};
+        }
+    }
+
+    TraceSpan span{"decode"};
+    QImage image;
+    auto cache = options.iconCache;
+    bool cacheHit = false;
+    if (!cache) {
+        image = decodeIcon(data, info, targetSize, options.pixelPool);
+    } else {
+        auto digest = IconCache::digest(data, info.dataLength);
+        cacheHit = cache->find(digest, targetSize, image);
+        if (!cacheHit) {
+            image = decodeIcon(data, info, targetSize, options.pixelPool);
+            cache->insert(digest, targetSize, image);
+        }
+    }
+
+    if (stats && !image.isNull()) {
+        stats->icon = info;
+        stats->iconCacheHit = cacheHit;
+    }
+    if (trace && !image.isNull()) {
+        trace->setIcon(info);
+    }
+    return image;
+}
+
+QImage ExecutableIcons::render(QSize targetSize, ExtractionStats *stats) {
+    // Reads and pixels are accounted across all the attempts, and entries
+    // naming an icon that has already failed are skipped.
+    beginRender();
+
+    // Only the chosen variant is probed, along with any that don't give their
+    // depth; the next few are tried only if it fails. The ranking is scratch,
+    // so it stays on the stack rather than growing the handle's arena on
+    // every render.
+    std::byte buffer[64 * sizeof(int)];
+    std::pmr::monotonic_buffer_resource scratch{buffer, sizeof(buffer)};
+    ArenaVector<int> order(entries.size(), &scratch);
+    {
+        TraceSpan span{"select"};
+        resolveUnknownDepths();
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return IconScore{variantList[a], targetSize} < IconScore{variantList[b], targetSize};
+        });
+    }
+
+    QImage image;
+    quint16 tried[MAX_RENDER_ATTEMPTS];
+    int attempts = 0;
+    for (auto variant : order) {
+        auto id = entries[variant].resourceId;
+        if (std::find(tried, tried + attempts, id) != tried + attempts) {
+            continue;
+        }
+        tried[attempts++] = id;
+        image = renderVariant(variant, targetSize, stats);
+        if (!image.isNull() || overBudget() || attempts == MAX_RENDER_ATTEMPTS) {
+            break;
+        }
+    }
+    return finishRender(image, stats);
+}
+
+// Records the outcome of a render, by size or by variant, for failure(),
+// the caller's stats and the trace.
+QImage ExecutableIcons::finishRender(const QImage &image, ExtractionStats *stats) {
+    lastFailure = failureFor(image);
+    if (stats) {
+        stats->format = exeFormat;
+        stats->rejection = rejected;
+        stats->mapped = source.isMapped();
+        stats->overBudget = overBudget();
+        stats->permanentFailure = failureIsPermanent();
+        stats->io = source.stats();
+    }
+    if (auto trace = Trace::current()) {
+        trace->setFormat(exeFormat);
+        if (options.pixelPool) {
+            trace->setPoolStats(options.pixelPool->stats());
+        }
+        if (lastFailure) {
+            trace->fail(lastFailure);
+        }
+    }
+    return image;
+}
+
+bool ExecutableIcons::failureIsPermanent() const {
+    if (!lastFailure || source.readFailed()) {
+        return false;
+    }
+    return rejected != Rejection::None || !overBudget();
+}
+
+const char *ExecutableIcons::failureFor(const QImage &image) const {
+    if (rejected != Rejection::None) {
+        return rejectionName(rejected);
+    }
+    if (overBudget()) {
+        return "over budget";
+    }
+    if (!pe && !ne) {
+        return "no PE or NE header";
+    }
+    if (entries.empty()) {
+        return "no icon group";
+    }
+    if (image.isNull()) {
+        return "no decodable icon";
+    }
+    return nullptr;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "arena.h"
+#include "budget.h"
+#include "exeutil.h"
+#include "ne.h"
+#include "pe.h"
+#include "reader.h"
+#include "resource.h"
+
+#include <QIODevice>
+#include <QImage>
+
+#include <memory>
+#include <optional>
+
+// The icons of one executable, from a single parse of its headers and
+// resource tree.
+//
+// The variants come from the main icon group's directory, and nothing is
+// decoded until render() asks for it, at whatever size. The handle keeps the
+// device open, so it can be held on to while the same file is requested
+// again at other sizes. All parser state lives in the handle's arena. Not
+// thread-safe.
+class ExecutableIcons {
+public:
+    struct Variant {
+        QSize size;
+        // 0 until probed if the group entry doesn't give it.
+        int bpp;
+        quint32 bytes;
+    };
+
+    // Parses `file`, which must stay open for as long as the handle exists.
+    explicit ExecutableIcons(QIODevice *file, const ExtractionOptions &options = {});
+    explicit ExecutableIcons(std::unique_ptr<QIODevice> file, const ExtractionOptions &options = {});
+    ~ExecutableIcons();
+
+    ExecutableIcons(const ExecutableIcons &) = delete;
+    ExecutableIcons &operator=(const ExecutableIcons &) = delete;
+
+    ExeFormat format() const { return exeFormat; }
+    Rejection rejection() const { return rejected; }
+    // Whether the parse or the last decode ran out of its ParseLimits.
+    bool overBudget() const;
+    const ArenaVector<Variant> &variants() const { return variantList; }
+    // Why the last render() came back empty, or nullptr if it didn't.
+    const char *failure() const { return lastFailure; }
+    // Whether that failure is down to the file's contents alone, and so
+    // would come back for as long as the file stays the same: a rejection,
+    // no headers or icon group, or icons that don't decode, all without a
+    // read from the device having failed. Running out of ParseLimits doesn't
+    // count, since the limits may change.
+    bool failureIsPermanent() const;
+
+    // Decodes the variant that best suits `targetSize`, or failing that one
+    // of the next best, within a single allowance of ParseLimits.
+    QImage render(QSize targetSize, ExtractionStats *stats = nullptr);
+
+    // Decodes one particular variant, downscaled to fit `targetSize` if it
+    // is a DIB.
+    QImage render(int variant, QSize targetSize, ExtractionStats *stats = nullptr);
+
+private:
+    void parse();
+    void beginRender();
+    QImage renderVariant(int variant, QSize targetSize, ExtractionStats *stats);
+    QImage finishRender(const QImage &image, ExtractionStats *stats);
+    bool probe(int variant, IconInfo &info);
+    void resolveUnknownDepths();
+    const char *failureFor(const QImage &image) const;
+
+    std::unique_ptr<QIODevice> owned;
+    Arena arena;
+    ExtractionOptions options;
+    ParseBudget budget{options.limits};
+    ByteSource source;
+    ByteReader reader;
+    std::optional<PortableExecutableResourceReader> pe;
+    std::optional<NewExecutableResourceReader> ne;
+
+    ExeFormat exeFormat = ExeFormat::Unknown;
+    Rejection rejected = Rejection::None;
+    const char *lastFailure = nullptr;
+    // What is left of the current render's pixel allowance.
+    qint64 pixelsLeft = 0;
+    ArenaVector<RtGroupIconDirectoryEntry> entries{arena.resource()};
+    ArenaVector<Variant> variantList{arena.resource()};
+    ArenaVector<std::optional<IconInfo>> probed{arena.resource()};
+};
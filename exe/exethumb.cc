@@ -1,13 +1,27 @@
 #include "exethumb.h"
+#include "exeicons.h"
 #include "exeutil.h"
+#include "trace.h"
 
 #include <QFile>
 
+#include <memory>
+#include <optional>
+
 #include <KPluginFactory>
 #include <kio/thumbnailcreator.h>
 
 K_PLUGIN_CLASS_WITH_JSON(ExeCreator, "exethumbnail.json")
 
+namespace {
+
+// Open files kept around for requests at other sizes.
+constexpr int MAX_HANDLES = 4;
+
+constexpr const char *INDEXED_NO_ICON = "indexed as having no icon";
+
+}
+
 ExeCreator::ExeCreator(QObject *parent, const QVariantList &args)
     : KIO::ThumbnailCreator(parent, args)
 {
@@ -15,14 +29,117 @@ ExeCreator::ExeCreator(QObject *parent, const QVariantList &args)
 
 ExeCreator::~ExeCreator() = default;
 
+std::shared_ptr<ExecutableIcons> ExeCreator::open(const QUrl &url)
+{
+    auto file = std::make_unique<QFile>(url.toLocalFile());
+    if (!file->open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        return nullptr;
+    }
+
+    ExtractionOptions options;
+    options.iconCache = &icons;
+    options.pixelPool = &pixels;
+    return std::make_shared<ExecutableIcons>(std::move(file), options);
+}
+
+std::shared_ptr<ExecutableIcons> ExeCreator::handleFor(const QUrl &url, const ThumbnailKey &identity)
+{
+    for (int i = 0; i < handles.size(); i++) {
+        if (handles[i].url != url) {
+            continue;
+        }
+        auto handle = handles.takeAt(i);
+        if (!(handle.identity == identity)) {
+            // The file changed since it was parsed.
+            break;
+        }
+        handles.prepend(handle);
+        return handle.icons;
+    }
+
+    auto exe = open(url);
+    if (exe) {
+        handles.prepend({url, identity, exe});
+        if (handles.size() > MAX_HANDLES) {
+            handles.removeLast();
+        }
+    }
+    return exe;
+}
+
 KIO::ThumbnailResult ExeCreator::create(const KIO::ThumbnailRequest &request)
 {
-    QFile file{request.url().toLocalFile()};
-    if (!file.open(QIODevice::ReadOnly)) {
+    const auto url = request.url();
+    auto path = url.isLocalFile() ? url.toLocalFile() : QString();
+
+    std::optional<Trace> trace;
+    if (Trace::enabled()) {
+        trace.emplace(url.toString(), request.targetSize());
+    }
+
+    // Files that haven't changed since the last visit skip parsing entirely:
+    // recent outcomes are answered from memory, older failures from the
+    // index. KIO caches the thumbnails themselves.
+    ThumbnailKey key;
+    bool indexed = !path.isEmpty() && ThumbnailKey::forFile(path, request.targetSize(), key);
+    if (indexed) {
+        QImage cached;
+        const char *reason = nullptr;
+        bool known;
+        {
+            TraceSpan span{"recent"};
+            known = results.find(key, cached, reason);
+        }
+        if (known) {
+            if (trace) {
+                trace->setCached();
+                if (reason) {
+                    trace->fail(reason);
+                }
+            }
+            return cached.isNull() ? KIO::ThumbnailResult::fail() : KIO::ThumbnailResult::pass(cached);
+        }
+    }
+
+    bool noIcon = false;
+    if (indexed) {
+        TraceSpan span{"index"};
+        noIcon = index.hasNoIcon(key);
+    }
+    if (noIcon) {
+        results.insertFailure(key, INDEXED_NO_ICON);
+        if (trace) {
+            trace->fail(INDEXED_NO_ICON);
+        }
         return KIO::ThumbnailResult::fail();
     }
 
-    auto result = getIconForWindowsExecutable(&file, request.targetSize());
+    // Other sizes of the file reuse its parse, unless it changed since.
+    std::shared_ptr<ExecutableIcons> exe;
+    {
+        TraceSpan span{"open"};
+        exe = indexed ? handleFor(url, anySize(key)) : open(url);
+    }
+    if (!exe) {
+        if (trace) {
+            trace->fail("unable to open");
+        }
+        return KIO::ThumbnailResult::fail();
+    }
+
+    auto result = exe->render(request.targetSize());
+    if (indexed) {
+        // A failed read or a parse cut short by the limits may not happen
+        // again, so only failures down to the file itself are remembered.
+        if (result.isNull()) {
+            if (exe->failureIsPermanent()) {
+                index.insertNoIcon(key);
+                results.insertFailure(key, exe->failure());
+            }
+        } else {
+            results.insert(key, result);
+        }
+    }
     if (result.isNull()) {
         return KIO::ThumbnailResult::fail();
     }
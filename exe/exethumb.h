@@ -1,6 +1,18 @@
 #pragma once
+#include "iconcache.h"
+#include "pixelpool.h"
+#include "resultcache.h"
+#include "thumbindex.h"
+
+#include <QUrl>
+#include <QVector>
+
+#include <memory>
+
 #include <KIO/ThumbnailCreator>
 
+class ExecutableIcons;
+
 class ExeCreator : public KIO::ThumbnailCreator
 {
 public:
@@ -8,4 +20,23 @@ public:
     ~ExeCreator() override;
 
     KIO::ThumbnailResult create(const KIO::ThumbnailRequest &request) override;
+
+private:
+    // A parsed file kept open so that requests for other sizes of the same
+    // file skip straight to decoding.
+    struct Handle {
+        QUrl url;
+        ThumbnailKey identity;
+        std::shared_ptr<ExecutableIcons> icons;
+    };
+
+    std::shared_ptr<ExecutableIcons> open(const QUrl &url);
+    std::shared_ptr<ExecutableIcons> handleFor(const QUrl &url, const ThumbnailKey &identity);
+
+    ThumbnailIndex index;
+    ResultCache results;
+    PixelPool pixels;
+    IconCache icons;
+    // Most recently used first.
+    QVector<Handle> handles;
 };
@@ -1,97 +1,56 @@
 #include "exeutil.h"
-#include "dib.h"
-#include "ne.h"
-#include "pe.h"
+#include "exeicons.h"
+#include "trace.h"
 
-#include <QDataStream>
-#include <QMap>
-#include <QVector>
-#include <QImageReader>
+#include <QFileDevice>
+#include <QSaveFile>
 
 #include <optional>
-#include <qglobal.h>
 
-namespace {
-
-static QImage parseIcon(QDataStream &s, IconInfo info) {
-    if (info.dataOffset == 0) return {};
-
-    if (!s.device()->seek(info.dataOffset)) { return {}; }
-
-    if (info.png) {
-        QImageReader r{s.device(), "PNG"};
-        return r.read();
-    }
-
-    BitmapInfoHeader header;
-    s >> header;
-
-    QImage image;
-    if (!readIconDibBody(s, header, image)) {
-        return {};
+const char *formatName(ExeFormat format) {
+    switch (format) {
+    case ExeFormat::Ne: return "NE";
+    case ExeFormat::Pe32: return "PE32";
+    case ExeFormat::Pe32Plus: return "PE32+";
+    case ExeFormat::Unknown: break;
     }
-
-    return image;
+    return "unknown";
 }
 
-QVector<IconInfo> getIconsForWindowsExecutable(QDataStream &ds) {
-    // Read DOS header.
-    DosHeader dosHeader;
-    ds >> dosHeader;
-
-    // Verify the MZ header.
-    if (dosHeader.signature[0] != 'M' || dosHeader.signature[1] != 'Z') {
-        return {};
-    }
+QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize) {
+    return getIconForWindowsExecutable(file, targetSize, ExtractionOptions{}, nullptr);
+}
 
-    PortableExecutableResourceReader pe{&ds, dosHeader};
-    if (pe.parseHeaders()) {
-        return pe.readMainIconGroup();
-    }
+QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize, ExtractionStats *stats) {
+    return getIconForWindowsExecutable(file, targetSize, ExtractionOptions{}, stats);
+}
 
-    NewExecutableResourceReader ne{&ds, dosHeader};
-    if (ne.parseHeaders()) {
-        return ne.readMainIconGroup();
+QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize, const ExtractionOptions &options, ExtractionStats *stats) {
+    // Callers that trace whole requests have already started one.
+    std::optional<Trace> trace;
+    if (!Trace::current() && Trace::enabled()) {
+        auto fileDevice = qobject_cast<QFileDevice *>(file);
+        trace.emplace(fileDevice ? fileDevice->fileName() : QString(), targetSize);
     }
 
-    return {};
+    ExecutableIcons icons{file, options};
+    return icons.render(targetSize, stats);
 }
 
+QImage fitThumbnail(const QImage &image, int size) {
+    if (image.width() <= size && image.height() <= size) {
+        return image;
+    }
+    return image.scaled(QSize{size, size}, Qt::KeepAspectRatio, Qt::SmoothTransformation);
 }
 
-QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize) {
-    QDataStream ds{file};
-    ds.setByteOrder(QDataStream::LittleEndian);
-
-    IconInfo best{};
-
-    for (auto icon : getIconsForWindowsExecutable(ds)) {
-        // Always prefer greater bpp
-        if (icon.bpp > best.bpp) {
-            best = icon;
-            continue;
-        }
-
-        // Don't consider lower bpp
-        if (icon.bpp < best.bpp) {
-            continue;
-        }
-
-        // Prefer bigger thumbnails only when we don't have one as big as the target size.
-        if ((best.size.width() < targetSize.width() &&
-             icon.size.width() > best.size.width())) {
-            best = icon;
-            continue;
-        }
-
-        // Prefer smaller thumbnails if they are closer to the target size.
-        if ((best.size.width() > targetSize.width() &&
-             icon.size.width() >= targetSize.width() &&
-             icon.size.width() < best.size.width())) {
-            best = icon;
-            continue;
-        }
+bool writeThumbnail(const QImage &image, const QString &path, QFileDevice::Permissions permissions) {
+    QSaveFile file{path};
+    if (!file.open(QIODevice::WriteOnly) || !image.save(&file, "PNG")) {
+        return false;
     }
-
-    return parseIcon(ds, best);
+    if (permissions != QFileDevice::Permissions()) {
+        file.setPermissions(permissions);
+    }
+    return file.commit();
 }
@@ -1,5 +1,59 @@
 #pragma once
+#include "budget.h"
+#include "classify.h"
+#include "common.h"
+#include "reader.h"
+
+#include <QFileDevice>
 #include <QIODevice>
 #include <QImage>
 
+class IconCache;
+class PixelPool;
+
+// What happened while extracting an icon; used by the benchmark tooling.
+struct ExtractionStats {
+    ExeFormat format = ExeFormat::Unknown;
+    Rejection rejection = Rejection::None;
+    IconInfo icon;
+    bool mapped = false;
+    bool iconCacheHit = false;
+    // Gave up after running into one of the ParseLimits.
+    bool overBudget = false;
+    // No icon, and none will turn up on another try: the file itself has
+    // none, rather than a read failing or the limits cutting the parse short.
+    bool permanentFailure = false;
+    ByteSource::Stats io;
+};
+
+struct ExtractionOptions {
+    ClassifierOptions classifier;
+    ParseLimits limits;
+    // Reuses decoded icons across files with identical icon resources.
+    IconCache *iconCache = nullptr;
+    // Recycles the pixel memory of decoded icons.
+    PixelPool *pixelPool = nullptr;
+};
+
+// Bumped whenever a change to the classifier, parser or decoders may find an
+// icon in files that earlier versions failed on, so that the failures those
+// versions remembered are dropped.
+constexpr quint32 PARSER_VERSION = 1;
+
+// "NE", "PE32", "PE32+" or "unknown", as the tools print it.
+const char *formatName(ExeFormat format);
+
 QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize);
+QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize, ExtractionStats *stats);
+QImage getIconForWindowsExecutable(QIODevice *file, QSize targetSize, const ExtractionOptions &options, ExtractionStats *stats = nullptr);
+
+// Scales `image` down to at most `size` pixels on either side, keeping its
+// aspect ratio; icons that come out bigger (large PNG icons, mostly) need it
+// before they are written out as thumbnails.
+QImage fitThumbnail(const QImage &image, int size);
+
+// Saves `image` as a PNG at `path` under a temporary name and renames it into
+// place, so readers never see a partial thumbnail. `permissions`, if given,
+// are set on the file.
+bool writeThumbnail(const QImage &image, const QString &path,
+                    QFileDevice::Permissions permissions = QFileDevice::Permissions());
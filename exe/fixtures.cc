@@ -0,0 +1,402 @@
+#include "fixtures.h"
+#include "pe.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QImage>
+#include <QtEndian>
+
+namespace {
+
+constexpr quint32 PE_HEADER_OFFSET = 0x80;
+constexpr quint32 SECTION_ALIGNMENT = 0x1000;
+constexpr quint32 FILE_ALIGNMENT = 0x200;
+constexpr quint16 NE_ALIGNMENT_SHIFT = 4;
+constexpr quint16 RT_ICON = 3;
+constexpr quint16 RT_RCDATA = 10;
+constexpr quint16 RT_GROUP_ICON = 14;
+
+struct Writer {
+    QByteArray data;
+
+    int pos() const { return data.size(); }
+    void u8(quint8 v) { data.append(char(v)); }
+    void u16(quint16 v) { u8(v & 0xff); u8(v >> 8); }
+    void u32(quint32 v) { u16(v & 0xffff); u16(v >> 16); }
+    void bytes(const QByteArray &v) { data.append(v); }
+    void padTo(int offset) { if (pos() < offset) { data.append(QByteArray(offset - pos(), '\0')); } }
+    void align(int alignment) { padTo((pos() + alignment - 1) / alignment * alignment); }
+    void patch32(int offset, quint32 v) { qToLittleEndian<quint32>(v, data.data() + offset); }
+};
+
+int alignUp(int value, int alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+struct FixtureResource {
+    quint16 id;
+    QByteArray data;
+};
+
+struct FixtureResourceType {
+    quint16 type;
+    QVector<FixtureResource> resources;
+};
+
+QVector<FixtureResourceType> fixtureResources(const FixtureSpec &spec) {
+    FixtureResourceType icons{RT_ICON, {}};
+    Writer group;
+    group.u16(0);
+    group.u16(1);
+    group.u16(spec.icons.size());
+    for (int i = 0; i < spec.icons.size(); i++) {
+        const auto &icon = spec.icons[i];
+        auto data = buildFixtureIcon(icon);
+        group.u8(icon.size >= 256 ? 0 : icon.size);
+        group.u8(icon.size >= 256 ? 0 : icon.size);
+        group.u8(icon.bpp < 8 ? 1 << icon.bpp : 0);
+        group.u8(0);
+        group.u16(1);
+        group.u16(icon.bpp);
+        group.u32(data.size());
+        group.u16(i + 1);
+        icons.resources.append({quint16(i + 1), data});
+    }
+
+    FixtureResourceType filler{RT_RCDATA, {}};
+    for (int i = 0; i < spec.extraResources; i++) {
+        filler.resources.append({quint16(i + 1), QByteArray(16, char(i))});
+    }
+
+    // Types are sorted by ID, as in real resource directories.
+    QVector<FixtureResourceType> types;
+    if (!icons.resources.isEmpty()) { types.append(icons); }
+    if (!filler.resources.isEmpty()) { types.append(filler); }
+    types.append({RT_GROUP_ICON, {{1, group.data}}});
+    return types;
+}
+
+QByteArray buildResourceSection(const QVector<FixtureResourceType> &types, quint32 rva) {
+    // Layout: root directory, one directory per type, one language directory
+    // per resource, all data entries, then the resource data itself.
+    auto dirSize = [](int entries) { return 16 + 8 * entries; };
+    auto dirHeader = [](Writer &w, int entries) {
+        w.u32(0); w.u32(0); w.u16(0); w.u16(0); w.u16(0); w.u16(entries);
+    };
+
+    int numResources = 0;
+    int typeDirsSize = 0;
+    for (const auto &type : types) {
+        numResources += type.resources.size();
+        typeDirsSize += dirSize(type.resources.size());
+    }
+
+    int typeDirsOffset = dirSize(types.size());
+    int langDirsOffset = typeDirsOffset + typeDirsSize;
+    int dataEntriesOffset = langDirsOffset + numResources * dirSize(1);
+    int dataOffset = dataEntriesOffset + numResources * 16;
+
+    Writer w;
+    dirHeader(w, types.size());
+    int typeDir = typeDirsOffset;
+    for (const auto &type : types) {
+        w.u32(type.type);
+        w.u32(SUBDIR_BIT_MASK | typeDir);
+        typeDir += dirSize(type.resources.size());
+    }
+
+    int langDir = langDirsOffset;
+    for (const auto &type : types) {
+        dirHeader(w, type.resources.size());
+        for (const auto &resource : type.resources) {
+            w.u32(resource.id);
+            w.u32(SUBDIR_BIT_MASK | langDir);
+            langDir += dirSize(1);
+        }
+    }
+
+    int dataEntry = dataEntriesOffset;
+    for (const auto &type : types) {
+        for (int i = 0; i < type.resources.size(); i++) {
+            dirHeader(w, 1);
+            w.u32(1033);
+            w.u32(dataEntry);
+            dataEntry += 16;
+        }
+    }
+
+    int data = dataOffset;
+    for (const auto &type : types) {
+        for (const auto &resource : type.resources) {
+            w.u32(rva + data);
+            w.u32(resource.data.size());
+            w.u32(0);
+            w.u32(0);
+            data += alignUp(resource.data.size(), 8);
+        }
+    }
+
+    for (const auto &type : types) {
+        for (const auto &resource : type.resources) {
+            w.bytes(resource.data);
+            w.align(8);
+        }
+    }
+
+    return w.data;
+}
+
+void writeDosHeader(Writer &w) {
+    w.bytes(QByteArrayLiteral("MZ"));
+    w.padTo(0x3C);
+    w.u32(PE_HEADER_OFFSET);
+    w.padTo(PE_HEADER_OFFSET);
+}
+
+QByteArray buildPortableExecutable(const FixtureSpec &spec) {
+    bool plus = spec.format == ExeFormat::Pe32Plus;
+    int numSections = spec.extraSections + 1;
+    quint16 optionalHeaderSize = plus ? 240 : 224;
+
+    Writer w;
+    writeDosHeader(w);
+    w.bytes(QByteArray("PE\0\0", 4));
+
+    // COFF file header.
+    w.u16(plus ? 0x8664 : 0x014c);
+    w.u16(numSections);
+    w.u32(0);
+    w.u32(0);
+    w.u32(0);
+    w.u16(optionalHeaderSize);
+    w.u16(plus ? 0x0022 : 0x0102);
+
+    // Optional header; only the parts the parser and Windows loader care about
+    // for identification are filled in.
+    int optionalHeader = w.pos();
+    w.u16(plus ? 0x020b : 0x010b);
+    w.padTo(optionalHeader + 68);
+    w.u16(2); // IMAGE_SUBSYSTEM_WINDOWS_GUI
+    w.padTo(optionalHeader + (plus ? 108 : 92));
+    w.u32(16);
+    int dataDirectories = w.pos();
+    w.padTo(optionalHeader + optionalHeaderSize);
+
+    int sectionTable = w.pos();
+    int rawOffset = alignUp(sectionTable + numSections * 40, FILE_ALIGNMENT);
+    quint32 rva = SECTION_ALIGNMENT;
+
+    for (int i = 0; i < spec.extraSections; i++) {
+        auto name = QByteArray(".s") + QByteArray::number(i);
+        name.resize(8);
+        w.bytes(name);
+        w.u32(FILE_ALIGNMENT);
+        w.u32(rva);
+        w.u32(FILE_ALIGNMENT);
+        w.u32(rawOffset);
+        w.u32(0);
+        w.u32(0);
+        w.u16(0);
+        w.u16(0);
+        w.u32(0x40000040);
+        rva += SECTION_ALIGNMENT;
+        rawOffset += FILE_ALIGNMENT;
+    }
+
+    auto rsrc = buildResourceSection(fixtureResources(spec), rva);
+    int rsrcRawSize = alignUp(rsrc.size(), FILE_ALIGNMENT);
+    w.bytes(QByteArray(".rsrc\0\0\0", 8));
+    w.u32(rsrc.size());
+    w.u32(rva);
+    w.u32(rsrcRawSize);
+    w.u32(rawOffset);
+    w.u32(0);
+    w.u32(0);
+    w.u16(0);
+    w.u16(0);
+    w.u32(0x40000040);
+
+    w.patch32(dataDirectories + 2 * 8, rva);
+    w.patch32(dataDirectories + 2 * 8 + 4, rsrc.size());
+
+    w.padTo(rawOffset);
+    w.bytes(rsrc);
+    w.padTo(rawOffset + rsrcRawSize);
+
+    return w.data;
+}
+
+QByteArray buildNewExecutable(const FixtureSpec &spec) {
+    auto types = fixtureResources(spec);
+
+    int tableSize = 2 + 2;
+    for (const auto &type : types) {
+        tableSize += 8 + 12 * type.resources.size();
+    }
+
+    Writer w;
+    writeDosHeader(w);
+    int header = w.pos();
+    w.bytes(QByteArrayLiteral("NE"));
+    w.padTo(header + 0x24);
+    w.u16(64);
+    w.padTo(header + 0x34);
+    w.u16(0);
+    w.padTo(header + 64);
+
+    int table = w.pos();
+    int data = alignUp(table + tableSize, 1 << NE_ALIGNMENT_SHIFT);
+
+    w.u16(NE_ALIGNMENT_SHIFT);
+    for (const auto &type : types) {
+        w.u16(0x8000 | type.type);
+        w.u16(type.resources.size());
+        w.u32(0);
+        for (const auto &resource : type.resources) {
+            auto length = alignUp(resource.data.size(), 1 << NE_ALIGNMENT_SHIFT);
+            w.u16(data >> NE_ALIGNMENT_SHIFT);
+            w.u16(length >> NE_ALIGNMENT_SHIFT);
+            w.u16(0x1c30);
+            w.u16(0x8000 | resource.id);
+            w.u32(0);
+            data += length;
+        }
+    }
+    w.u16(0);
+
+    for (const auto &type : types) {
+        for (const auto &resource : type.resources) {
+            w.align(1 << NE_ALIGNMENT_SHIFT);
+            w.bytes(resource.data);
+        }
+    }
+    w.align(1 << NE_ALIGNMENT_SHIFT);
+
+    return w.data;
+}
+
+quint8 pattern(int x, int y, int channel) {
+    return quint8(x * 7 + y * 13 + channel * 61);
+}
+
+}
+
+QByteArray buildFixtureIcon(const FixtureIcon &icon) {
+    int w = icon.size, h = icon.size;
+
+    if (icon.png) {
+        QImage image{w, h, QImage::Format_ARGB32};
+        for (int y = 0; y < h; y++) {
+            auto line = reinterpret_cast<QRgb *>(image.scanLine(y));
+            for (int x = 0; x < w; x++) {
+                line[x] = qRgba(pattern(x, y, 0), pattern(x, y, 1), pattern(x, y, 2), (x + y) % 5 ? 0xff : 0x80);
+            }
+        }
+        QByteArray data;
+        QBuffer buffer{&data};
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "PNG");
+        return data;
+    }
+
+    int colors = icon.bpp <= 8 ? 1 << icon.bpp : 0;
+    int xorStride = (((w * icon.bpp) + 31) & ~31) / 8;
+    int andStride = ((w + 31) & ~31) / 8;
+
+    Writer out;
+    out.u32(40);
+    out.u32(w);
+    out.u32(h * 2);
+    out.u16(1);
+    out.u16(icon.bpp);
+    out.u32(0);
+    out.u32((xorStride + andStride) * h);
+    out.u32(0);
+    out.u32(0);
+    out.u32(colors);
+    out.u32(0);
+
+    for (int i = 0; i < colors; i++) {
+        out.u8(pattern(i, 0, 0));
+        out.u8(pattern(i, 0, 1));
+        out.u8(pattern(i, 0, 2));
+        out.u8(0);
+    }
+
+    for (int y = 0; y < h; y++) {
+        int line = out.pos();
+        if (icon.bpp == 32) {
+            for (int x = 0; x < w; x++) {
+                out.u8(pattern(x, y, 0));
+                out.u8(pattern(x, y, 1));
+                out.u8(pattern(x, y, 2));
+                out.u8((x + y) % 5 ? 0xff : 0x80);
+            }
+        } else {
+            for (int i = 0; i < xorStride; i++) {
+                out.u8(pattern(i, y, 0));
+            }
+        }
+        out.padTo(line + xorStride);
+    }
+
+    for (int y = 0; y < h; y++) {
+        for (int i = 0; i < andStride; i++) {
+            out.u8(y < h / 4 ? 0xff : 0x00);
+        }
+    }
+
+    return out.data;
+}
+
+QByteArray buildFixture(const FixtureSpec &spec) {
+    if (spec.format == ExeFormat::Ne) {
+        return buildNewExecutable(spec);
+    }
+    return buildPortableExecutable(spec);
+}
+
+bool writeFixture(const FixtureSpec &spec, const QString &path) {
+    auto data = buildFixture(spec);
+
+    QFile file{path};
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    if (file.write(data) != data.size()) {
+        return false;
+    }
+
+    // Growing the file without writing leaves a hole on most filesystems, so
+    // multi-GB overlays cost next to nothing on disk.
+    if (spec.overlaySize > 0 && !file.resize(data.size() + spec.overlaySize)) {
+        return false;
+    }
+    return true;
+}
+
+QVector<FixtureSpec> standardFixtures() {
+    QVector<FixtureIcon> allDibs;
+    for (int bpp : {1, 4, 8, 16, 24, 32}) {
+        for (int size : {16, 32, 48}) {
+            allDibs.append({size, bpp});
+        }
+    }
+
+    QVector<FixtureIcon> mixed = allDibs;
+    mixed.append({256, 32, true});
+
+    constexpr qint64 GiB = 1024 * 1024 * 1024;
+
+    QVector<FixtureSpec> fixtures;
+    fixtures.append({QStringLiteral("pe32-dib"), ExeFormat::Pe32, allDibs});
+    fixtures.append({QStringLiteral("pe32-png"), ExeFormat::Pe32, {{16, 32}, {32, 32}, {48, 32}, {256, 32, true}}});
+    fixtures.append({QStringLiteral("pe32plus-png"), ExeFormat::Pe32Plus, {{32, 32}, {64, 32, true}, {128, 32, true}, {256, 32, true}}});
+    fixtures.append({QStringLiteral("pe32-many-sections"), ExeFormat::Pe32, {{32, 32}, {48, 32}}, 95});
+    fixtures.append({QStringLiteral("pe32-many-resources"), ExeFormat::Pe32, mixed, 0, 5000});
+    fixtures.append({QStringLiteral("pe32plus-overlay"), ExeFormat::Pe32Plus, {{48, 32}, {256, 32, true}}, 0, 0, 4 * GiB});
+    fixtures.append({QStringLiteral("ne-dib"), ExeFormat::Ne, {{16, 1}, {32, 1}, {32, 4}, {32, 8}}});
+    fixtures.append({QStringLiteral("ne-many-resources"), ExeFormat::Ne, {{32, 4}, {32, 8}}, 0, 3000});
+    fixtures.append({QStringLiteral("ne-overlay"), ExeFormat::Ne, {{32, 8}}, 0, 0, 2 * GiB});
+    return fixtures;
+}
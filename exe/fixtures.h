@@ -0,0 +1,46 @@
+#pragma once
+#include "exeutil.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+// Synthetic executables for the benchmark tooling.
+//
+// These are built entirely in code so that the tools don't depend on a corpus
+// of real binaries, and so that pathological shapes (huge resource tables,
+// multi-GB overlays) are easy to produce.
+
+struct FixtureIcon {
+    int size;
+    int bpp;
+    bool png = false;
+};
+
+struct FixtureSpec {
+    QString name;
+    ExeFormat format = ExeFormat::Pe32;
+    QVector<FixtureIcon> icons;
+    int extraSections = 0;
+    int extraResources = 0;
+    qint64 overlaySize = 0;
+};
+
+// Upper bounds for the I/O and heap allocations a single extraction of a
+// fixture should need, mapped or read through the block cache. They are
+// measured, see pethumbnail-bench --record-budgets.
+struct FixtureBudget {
+    qint64 maxBytesRead = 0;
+    int maxReads = 0;
+    int maxSeeks = 0;
+    int maxAllocations = 0;
+};
+
+QByteArray buildFixtureIcon(const FixtureIcon &icon);
+
+// Builds the executable image. The overlay is not included; use
+// writeFixture() to get a sparse file with the overlay appended.
+QByteArray buildFixture(const FixtureSpec &spec);
+bool writeFixture(const FixtureSpec &spec, const QString &path);
+
+QVector<FixtureSpec> standardFixtures();
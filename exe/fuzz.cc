@@ -0,0 +1,53 @@
+// libFuzzer harness: feeds arbitrary bytes to getIconForWindowsExecutable.
+//
+// Besides crashes and sanitizer reports, it tracks the slowest input seen so
+// far and prints each new worst case. With PETHUMBNAIL_FUZZ_MAX_USECS set,
+// any input slower than that aborts, so libFuzzer saves it as a finding.
+
+#include "exeutil.h"
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Both the downscaling and the full-size decoders.
+const QSize TARGET_SIZES[] = {{32, 32}, {256, 256}};
+
+qint64 worstUsecs = 0;
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static const qint64 maxUsecs = qEnvironmentVariableIntValue("PETHUMBNAIL_FUZZ_MAX_USECS");
+
+    auto bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size));
+    QBuffer buffer{&bytes};
+    buffer.open(QIODevice::ReadOnly);
+
+    // Parse everything the classifier would turn away, too.
+    ExtractionOptions options;
+    options.classifier.enabled = false;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (auto targetSize : TARGET_SIZES) {
+        getIconForWindowsExecutable(&buffer, targetSize, options);
+    }
+    auto usecs = timer.nsecsElapsed() / 1000;
+
+    if (usecs > worstUsecs) {
+        worstUsecs = usecs;
+        std::fprintf(stderr, "slowest input so far: %lld us (%zu bytes)\n", static_cast<long long>(usecs), size);
+    }
+    if (maxUsecs > 0 && usecs > maxUsecs) {
+        std::fprintf(stderr, "input took %lld us, over the %lld us limit\n", static_cast<long long>(usecs), static_cast<long long>(maxUsecs));
+        std::abort();
+    }
+    return 0;
+}
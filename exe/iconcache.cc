@@ -0,0 +1,43 @@
+#include "iconcache.h"
+
+#include <QCryptographicHash>
+#include <QMutexLocker>
+#include <QtEndian>
+
+#include <limits>
+
+IconCache::IconCache(qint64 maxBytes) {
+    // Costs are in KiB so that large limits still fit in an int.
+    images.setMaxCost(int(qMin<qint64>(maxBytes / 1024, std::numeric_limits<int>::max())));
+}
+
+QByteArray IconCache::digest(const uchar *data, qint64 length) {
+    QCryptographicHash hash{QCryptographicHash::Sha1};
+    hash.addData(reinterpret_cast<const char *>(data), int(length));
+    return hash.result();
+}
+
+QByteArray IconCache::keyFor(const QByteArray &digest, QSize targetSize) {
+    uchar size[8];
+    qToLittleEndian<qint32>(targetSize.width(), size);
+    qToLittleEndian<qint32>(targetSize.height(), size + 4);
+    return digest + QByteArray{reinterpret_cast<const char *>(size), sizeof(size)};
+}
+
+bool IconCache::find(const QByteArray &digest, QSize targetSize, QImage &image) {
+    QMutexLocker locker{&mutex};
+    auto cached = images.object(keyFor(digest, targetSize));
+    if (!cached) {
+        return false;
+    }
+    image = *cached;
+    return true;
+}
+
+void IconCache::insert(const QByteArray &digest, QSize targetSize, const QImage &image) {
+    if (image.isNull()) {
+        return;
+    }
+    QMutexLocker locker{&mutex};
+    images.insert(keyFor(digest, targetSize), new QImage{image}, int(qMax<qint64>(image.sizeInBytes() / 1024, 1)));
+}
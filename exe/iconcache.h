@@ -0,0 +1,30 @@
+#pragma once
+#include <QtGlobal>
+#include <QByteArray>
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+
+// Decoded icons keyed by a digest of their raw resource bytes and the target
+// size they were decoded for.
+//
+// Installers, versioned copies and per-language builds of the same program
+// usually carry byte-identical icons, so the decoded image of one file can be
+// handed out for all of them. QImage shares its pixels, so a directory full of
+// such files costs one image's worth of memory. Safe to share between threads.
+class IconCache {
+public:
+    explicit IconCache(qint64 maxBytes = 32 * 1024 * 1024);
+
+    static QByteArray digest(const uchar *data, qint64 length);
+
+    bool find(const QByteArray &digest, QSize targetSize, QImage &image);
+    void insert(const QByteArray &digest, QSize targetSize, const QImage &image);
+
+private:
+    static QByteArray keyFor(const QByteArray &digest, QSize targetSize);
+
+    QMutex mutex;
+    QCache<QByteArray, QImage> images;
+};
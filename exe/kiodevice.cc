@@ -0,0 +1,119 @@
+#include "kiodevice.h"
+
+#include <QEventLoop>
+#include <QTimer>
+
+#include <KIO/FileJob>
+
+#include <cstring>
+
+namespace {
+
+// Gives up on a worker that stops answering rather than hanging the
+// thumbnailer forever.
+constexpr int REQUEST_TIMEOUT_MS = 30 * 1000;
+
+}
+
+KioDevice::KioDevice(const QUrl &url)
+    : url{url}
+{
+}
+
+KioDevice::~KioDevice() {
+    close();
+}
+
+// Runs `loop` until one of the connected signals quits it. Returns false if
+// the job finished (failed or closed) or timed out instead.
+bool KioDevice::run(QEventLoop &loop) {
+    bool ok = true;
+    QObject::connect(job.data(), &KJob::result, &loop, [&] {
+        ok = false;
+        loop.quit();
+    });
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, [&] {
+        ok = false;
+        loop.quit();
+    });
+    timer.start(REQUEST_TIMEOUT_MS);
+    loop.exec(QEventLoop::ExcludeUserInputEvents);
+    return ok && job;
+}
+
+bool KioDevice::open(OpenMode mode) {
+    if (mode != ReadOnly && mode != (ReadOnly | Unbuffered)) {
+        return false;
+    }
+
+    job = KIO::open(url, QIODevice::ReadOnly);
+    job->setUiDelegate(nullptr);
+
+    QEventLoop loop;
+    QObject::connect(job.data(), &KIO::FileJob::open, &loop, &QEventLoop::quit);
+    if (!run(loop)) {
+        setErrorString(job ? job->errorString() : QStringLiteral("Unable to open %1").arg(url.toDisplayString()));
+        close();
+        return false;
+    }
+
+    fileSize = qint64(job->size());
+    jobPos = 0;
+    return QIODevice::open(mode);
+}
+
+void KioDevice::close() {
+    if (job) {
+        job->close();
+        job = nullptr;
+    }
+    fileSize = 0;
+    QIODevice::close();
+}
+
+bool KioDevice::seekJob(qint64 pos) {
+    if (pos == jobPos) {
+        return true;
+    }
+
+    QEventLoop loop;
+    QObject::connect(job.data(), &KIO::FileJob::position, &loop, [&](KIO::Job *, KIO::filesize_t offset) {
+        jobPos = qint64(offset);
+        loop.quit();
+    });
+    job->seek(KIO::filesize_t(pos));
+    return run(loop) && jobPos == pos;
+}
+
+qint64 KioDevice::readData(char *data, qint64 maxSize) {
+    if (!job || !seekJob(pos())) {
+        return -1;
+    }
+
+    maxSize = qMin(maxSize, fileSize - jobPos);
+    qint64 total = 0;
+
+    // Workers may answer a read with less than was asked for.
+    while (total < maxSize) {
+        QByteArray chunk;
+        QEventLoop loop;
+        QObject::connect(job.data(), &KIO::FileJob::data, &loop, [&](KIO::Job *, const QByteArray &bytes) {
+            chunk = bytes;
+            loop.quit();
+        });
+        job->read(KIO::filesize_t(maxSize - total));
+        if (!run(loop) || chunk.isEmpty()) {
+            break;
+        }
+        received += chunk.size();
+
+        auto n = qMin(qint64(chunk.size()), maxSize - total);
+        std::memcpy(data + total, chunk.constData(), size_t(n));
+        total += n;
+        jobPos += n;
+    }
+
+    return (total > 0 || job) ? total : -1;
+}
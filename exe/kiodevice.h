@@ -0,0 +1,54 @@
+#pragma once
+#include <QIODevice>
+#include <QPointer>
+#include <QUrl>
+
+namespace KIO {
+class FileJob;
+}
+
+class QEventLoop;
+
+// Random-access, read-only device over a remote file, built on KIO::open().
+//
+// Every read turns into a KIO seek plus read round trip, so this is meant to
+// sit under a ByteSource, whose block cache and read hints keep the number of
+// round trips down to a handful per file. Only the ranges the parser asks for
+// are transferred; the rest of the file is never downloaded.
+//
+// Calls block in a nested event loop until the worker answers, for up to 30 s
+// each. That loop leaves out user input but delivers every other event of the
+// calling thread, so only use the device where nothing queued on that thread
+// can reach back into the caller: a thread of its own, a command-line tool or
+// a test. The plugin doesn't use it; KIO hands it local copies of remote
+// files, and KIO has no blocking API for FileJob that would avoid the nested
+// loop.
+class KioDevice : public QIODevice {
+public:
+    explicit KioDevice(const QUrl &url);
+    ~KioDevice() override;
+
+    bool open(OpenMode mode) override;
+    void close() override;
+
+    bool isSequential() const override { return false; }
+    qint64 size() const override { return fileSize; }
+
+    // Bytes the worker has sent so far, for checking that reads only fetch
+    // the ranges asked for.
+    qint64 bytesReceived() const { return received; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    bool run(QEventLoop &loop);
+    bool seekJob(qint64 pos);
+
+    QUrl url;
+    QPointer<KIO::FileJob> job;
+    qint64 fileSize = 0;
+    qint64 jobPos = 0;
+    qint64 received = 0;
+};
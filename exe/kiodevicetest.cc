@@ -0,0 +1,141 @@
+// Reads a local file through KioDevice, i.e. through KIO::open() and the file
+// worker, and checks that every range comes back with the bytes on disk:
+// forward and backward seeks, reads cut short by the end of the file, and
+// the views a ByteSource makes on top of it. Also checks that only the ranges
+// asked for are transferred, not the whole file.
+
+#include "kiodevice.h"
+#include "reader.h"
+
+#include <QCoreApplication>
+#include <QTemporaryFile>
+#include <QUrl>
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr qint64 FILE_SIZE = 200 * 1024 + 123;
+
+struct Range {
+    qint64 offset;
+    qint64 count;
+};
+
+// In the order they are read, so that the device has to seek both ways.
+const Range RANGES[] = {
+    {0, 64},
+    {4096, 16 * 1024},
+    {150 * 1024, 40 * 1024},
+    {10, 3},
+    {FILE_SIZE - 100, 100},
+    {70 * 1024 + 1, 1},
+};
+
+char expectedByte(qint64 offset) {
+    return char(offset * 7 + offset / 251);
+}
+
+qint64 requestedBytes() {
+    qint64 total = 0;
+    for (const auto &range : RANGES) {
+        total += range.count;
+    }
+    return total;
+}
+
+bool matches(const char *data, qint64 offset, qint64 count) {
+    for (qint64 i = 0; i < count; i++) {
+        if (data[i] != expectedByte(offset + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication app{argc, argv};
+
+    QTemporaryFile file;
+    if (!file.open()) {
+        std::printf("unable to create a temporary file\n");
+        return 1;
+    }
+    QByteArray contents(int(FILE_SIZE), Qt::Uninitialized);
+    for (qint64 i = 0; i < FILE_SIZE; i++) {
+        contents[int(i)] = expectedByte(i);
+    }
+    if (file.write(contents) != contents.size() || !file.flush()) {
+        std::printf("unable to write %s\n", qPrintable(file.fileName()));
+        return 1;
+    }
+
+    KioDevice device{QUrl::fromLocalFile(file.fileName())};
+    if (!device.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        std::printf("unable to open: %s\n", qPrintable(device.errorString()));
+        return 1;
+    }
+
+    int failures = 0;
+    if (device.size() != FILE_SIZE) {
+        std::printf("FAIL size %lld, expected %lld\n", qlonglong(device.size()), qlonglong(FILE_SIZE));
+        failures++;
+    }
+
+    for (const auto &range : RANGES) {
+        QByteArray data(int(range.count), '\0');
+        if (!device.seek(range.offset) || device.read(data.data(), range.count) != range.count ||
+            !matches(data.constData(), range.offset, range.count)) {
+            std::printf("FAIL read %lld+%lld\n", qlonglong(range.offset), qlonglong(range.count));
+            failures++;
+        }
+    }
+
+    // Asking for more than is left returns what is left.
+    QByteArray tail(4096, '\0');
+    if (!device.seek(FILE_SIZE - 10) || device.read(tail.data(), tail.size()) != 10 ||
+        !matches(tail.constData(), FILE_SIZE - 10, 10)) {
+        std::printf("FAIL read past the end\n");
+        failures++;
+    }
+
+    // Seeks move the worker's position without transferring anything, so
+    // exactly the bytes read came over.
+    const auto expected = requestedBytes() + 10;
+    if (device.bytesReceived() != expected) {
+        std::printf("FAIL received %lld bytes for %lld read\n", qlonglong(device.bytesReceived()), qlonglong(expected));
+        failures++;
+    }
+
+    // The same ranges through the block cache, as the parser reads them.
+    ByteSource source{&device};
+    for (const auto &range : RANGES) {
+        auto data = source.view(range.offset, range.count);
+        if (!data || !matches(reinterpret_cast<const char *>(data), range.offset, range.count)) {
+            std::printf("FAIL view %lld+%lld\n", qlonglong(range.offset), qlonglong(range.count));
+            failures++;
+        }
+    }
+    if (source.view(FILE_SIZE - 10, 11)) {
+        std::printf("FAIL view past the end\n");
+        failures++;
+    }
+
+    // The block cache reads the whole 16 KiB blocks around each range, about
+    // half of the file here, but must leave the blocks no range touches.
+    const auto viaCache = device.bytesReceived() - expected;
+    if (viaCache >= FILE_SIZE * 3 / 4) {
+        std::printf("FAIL received %lld of %lld bytes through the block cache\n", qlonglong(viaCache), qlonglong(FILE_SIZE));
+        failures++;
+    }
+
+    if (failures) {
+        std::printf("%d failures\n", failures);
+        return 1;
+    }
+    std::printf("all reads match\n");
+    return 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include "reader.h"
+
+#include <QtGlobal>
+#include <QtEndian>
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// Compile-time layout descriptors for on-disk little-endian structures.
+//
+// A layout lists the byte offset of each field and the member it decodes
+// into. static_asserts check that fields are listed in order, don't overlap
+// and fit in the declared size, so a wrong offset fails to build. Decoding a
+// structure is then a single bounds-checked read followed by straight-line
+// unpacking, and arrays of structures are decoded from one read.
+//
+// Each structure's layout is declared next to its decoder:
+//
+//     template<> struct LayoutOf<PeDataDirectory> : Layout<PeDataDirectory, 8,
+//         Field<0, &PeDataDirectory::virtualAddress>,
+//         Field<4, &PeDataDirectory::size>> {};
+
+template<typename T>
+struct LayoutOf;
+
+namespace layout_detail {
+
+template<typename T>
+struct MemberPointer;
+
+template<typename S, typename T>
+struct MemberPointer<T S::*> {
+    using Struct = S;
+    using Type = T;
+};
+
+template<typename T>
+void decodeValue(const uchar *p, T &out) {
+    if constexpr (std::is_array_v<T>) {
+        for (std::size_t i = 0; i < std::extent_v<T>; i++) {
+            decodeValue(p + i * sizeof(out[0]), out[i]);
+        }
+    } else if constexpr (sizeof(T) == 1) {
+        std::memcpy(&out, p, 1);
+    } else {
+        out = qFromLittleEndian<T>(p);
+    }
+}
+
+template<std::size_t Size, typename... Fields>
+constexpr bool fieldsFit() {
+    constexpr std::size_t offsets[] = {Fields::offset...};
+    constexpr std::size_t sizes[] = {Fields::size...};
+    std::size_t end = 0;
+    for (std::size_t i = 0; i < sizeof...(Fields); i++) {
+        if (offsets[i] < end) {
+            return false;
+        }
+        end = offsets[i] + sizes[i];
+    }
+    return end <= Size;
+}
+
+}
+
+template<std::size_t Offset, auto Member>
+struct Field {
+    using Struct = typename layout_detail::MemberPointer<decltype(Member)>::Struct;
+    using Type = typename layout_detail::MemberPointer<decltype(Member)>::Type;
+
+    static constexpr std::size_t offset = Offset;
+    static constexpr std::size_t size = sizeof(Type);
+
+    static_assert(std::is_integral_v<std::remove_all_extents_t<Type>>, "fields must be integers or arrays of integers");
+
+    static void decode(const uchar *p, Struct &out) {
+        layout_detail::decodeValue(p + Offset, out.*Member);
+    }
+};
+
+template<typename Struct, std::size_t Size, typename... Fields>
+struct Layout {
+    static constexpr std::size_t size = Size;
+
+    static_assert((std::is_same_v<Struct, typename Fields::Struct> && ...), "field of another structure");
+    static_assert(layout_detail::fieldsFit<Size, Fields...>(), "fields out of order, overlapping or past the end");
+
+    static void decode(const uchar *p, Struct &out) {
+        (Fields::decode(p, out), ...);
+    }
+};
+
+// Decodes one structure, or zeroes it if the source runs out.
+template<typename T>
+ByteReader &readStruct(ByteReader &r, T &out) {
+    auto p = r.read(LayoutOf<T>::size);
+    if (p) {
+        LayoutOf<T>::decode(p, out);
+    } else {
+        out = T{};
+    }
+    return r;
+}
+
+// Decodes `count` consecutive structures from a single read and appends
+// them to `out`, which may be a QVector or a std::vector.
+template<typename Vector>
+bool appendArray(ByteReader &r, int count, Vector &out) {
+    using T = typename Vector::value_type;
+    if (count <= 0) {
+        return true;
+    }
+    auto p = r.read(qint64(count) * qint64(LayoutOf<T>::size));
+    if (!p) {
+        return false;
+    }
+    auto first = out.size();
+    out.resize(first + count);
+    for (int i = 0; i < count; i++, p += LayoutOf<T>::size) {
+        LayoutOf<T>::decode(p, out[first + i]);
+    }
+    return true;
+}
+
+template<typename Vector>
+bool readArray(ByteReader &r, int count, Vector &out) {
+    out.clear();
+    return appendArray(r, count, out);
+}
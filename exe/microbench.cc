@@ -0,0 +1,218 @@
+// Microbenchmarks for the innermost loops: the DIB scanline converters, the
+// icon DIB decoder, the group icon directory reader and the PE/NE header
+// parsers, all over in-memory fixtures.
+//
+// Every case reports pixels/s or files/s. Pass --benchmark_format=json (or
+// --benchmark_out=<file> --benchmark_out_format=json) for machine-readable
+// results to compare across changes.
+
+#include "dib.h"
+#include "dibline.h"
+#include "exe.h"
+#include "fixtures.h"
+#include "ne.h"
+#include "pe.h"
+#include "reader.h"
+#include "resource.h"
+
+#include <QCoreApplication>
+#include <QImage>
+#include <QVector>
+
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+constexpr int LINE_WIDTHS[] = {16, 32, 48, 64, 128, 256};
+constexpr int ICON_SIZES[] = {16, 32, 48, 64, 128, 256};
+constexpr int ICON_DEPTHS[] = {1, 4, 8, 16, 24, 32};
+
+void countPixels(benchmark::State &state, qint64 pixelsPerIteration) {
+    state.counters["pixels/s"] = benchmark::Counter(double(state.iterations()) * double(pixelsPerIteration),
+                                                    benchmark::Counter::kIsRate);
+}
+
+void countFiles(benchmark::State &state) {
+    state.counters["files/s"] = benchmark::Counter(double(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+// One scanline through one converter. The input is wide enough for 32 bpp,
+// so every converter reads the same buffer; the content doesn't matter.
+void lineBenchmark(benchmark::State &state, DibLineFn convert, int bpp) {
+    int w = int(state.range(0));
+    DibPalette palette;
+    for (int i = 0; i < 256; i++) {
+        palette.colors[i] = qRgb(i, 255 - i, i * 7);
+    }
+    palette.buildTables(bpp);
+
+    std::vector<uchar> in(size_t(w) * 4);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = uchar(i * 37);
+    }
+    std::vector<QRgb> out(size_t(w), qRgb(1, 2, 3));
+
+    for (auto _ : state) {
+        convert(&palette, in.data(), out.data(), w);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    countPixels(state, w);
+}
+
+void registerLineBenchmarks(const DibLineKernels &kernels) {
+    struct Converter {
+        const char *name;
+        DibLineFn convert;
+        int bpp;
+    };
+    const Converter converters[] = {
+        {"indexed1", kernels.indexed1, 1},
+        {"indexed4", kernels.indexed4, 4},
+        {"indexed8", kernels.indexed8, 8},
+        {"bgr555", kernels.bgr555, 16},
+        {"bgr888", kernels.bgr888, 24},
+        {"bgra8888", kernels.bgra8888, 32},
+        {"bgrx8888", kernels.bgrx8888, 32},
+        {"mask", kernels.mask, 1},
+    };
+
+    for (const auto &converter : converters) {
+        auto name = std::string("dibline/") + kernels.name + "/" + converter.name;
+        auto benchmark = benchmark::RegisterBenchmark(name.c_str(), lineBenchmark, converter.convert, converter.bpp);
+        for (int w : LINE_WIDTHS) {
+            benchmark->Arg(w);
+        }
+    }
+}
+
+// A whole icon: header, palette, XOR and AND planes. The third argument, if
+// non-zero, is the target size to downscale to while decoding.
+void iconBenchmark(benchmark::State &state) {
+    int size = int(state.range(0));
+    int bpp = int(state.range(1));
+    int target = int(state.range(2));
+    auto data = buildFixtureIcon({size, bpp});
+    auto targetSize = target ? QSize(target, target) : QSize();
+
+    QImage image;
+    for (auto _ : state) {
+        ByteSource source{reinterpret_cast<const uchar *>(data.constData()), data.size()};
+        ByteReader reader{&source};
+        BitmapInfoHeader header;
+        reader >> header;
+        if (!readIconDibBody(reader, header, image, targetSize)) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(image.constBits());
+    }
+    countPixels(state, qint64(size) * size);
+}
+
+QByteArray groupIconDirectory(int count) {
+    QByteArray data;
+    auto u8 = [&](int v) { data.append(char(v)); };
+    auto u16 = [&](int v) { u8(v & 0xff); u8(v >> 8); };
+    auto u32 = [&](quint32 v) { u16(v & 0xffff); u16(v >> 16); };
+
+    u16(0);
+    u16(1);
+    u16(count);
+    for (int i = 0; i < count; i++) {
+        int size = ICON_SIZES[i % std::size(ICON_SIZES)];
+        u8(size & 0xff);
+        u8(size & 0xff);
+        u8(0);
+        u8(0);
+        u16(1);
+        u16(32);
+        u32(quint32(size * size * 4 + 40));
+        u16(i + 1);
+    }
+    return data;
+}
+
+void groupDirectoryBenchmark(benchmark::State &state) {
+    auto data = groupIconDirectory(int(state.range(0)));
+    ArenaVector<RtGroupIconDirectoryEntry> entries;
+
+    for (auto _ : state) {
+        ByteSource source{reinterpret_cast<const uchar *>(data.constData()), data.size()};
+        ByteReader reader{&source};
+        if (!readResourceDirectory(reader, entries)) {
+            state.SkipWithError("read failed");
+            break;
+        }
+        benchmark::DoNotOptimize(entries.data());
+    }
+    countFiles(state);
+}
+
+// Headers, section table and resource tree of one fixture, from memory, with
+// fresh parser state each time as in a real extraction.
+void headersBenchmark(benchmark::State &state, const QByteArray &data, ExeFormat format) {
+    for (auto _ : state) {
+        ByteSource source{reinterpret_cast<const uchar *>(data.constData()), data.size()};
+        ByteReader reader{&source};
+        DosHeader dosHeader;
+        reader >> dosHeader;
+        ParseBudget budget;
+        bool ok;
+        if (format == ExeFormat::Ne) {
+            NewExecutableResourceReader ne{&reader, dosHeader, &budget};
+            ok = ne.parseHeaders();
+        } else {
+            PortableExecutableResourceReader pe{&reader, dosHeader, &budget};
+            ok = pe.parseHeaders();
+        }
+        if (!ok) {
+            state.SkipWithError("parse failed");
+            break;
+        }
+    }
+    countFiles(state);
+}
+
+void registerBenchmarks() {
+    registerLineBenchmarks(scalarDibLineKernels());
+    for (const auto &kernels : supportedDibLineKernels()) {
+        registerLineBenchmarks(kernels);
+    }
+
+    auto icons = benchmark::RegisterBenchmark("readIconDibBody", iconBenchmark);
+    icons->ArgNames({"size", "bpp", "target"});
+    for (int bpp : ICON_DEPTHS) {
+        for (int size : ICON_SIZES) {
+            icons->Args({size, bpp, 0});
+        }
+        // The common case of a large icon shown at a small size.
+        icons->Args({256, bpp, 48});
+    }
+
+    benchmark::RegisterBenchmark("readResourceDirectory", groupDirectoryBenchmark)
+        ->ArgName("entries")->Arg(1)->Arg(16)->Arg(256);
+
+    for (const auto &spec : standardFixtures()) {
+        auto name = std::string("parseHeaders/") + spec.name.toStdString();
+        benchmark::RegisterBenchmark(name.c_str(), headersBenchmark, buildFixture(spec), spec.format);
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication app{argc, argv};
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    registerBenchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,33 @@
+// Writes the synthetic executable fixtures, which pethumbnail-bench checks
+// against the budgets in fixture-budgets.tsv.
+
+#include "fixtures.h"
+
+#include <QCoreApplication>
+#include <QDir>
+
+int main(int argc, char **argv) {
+    QCoreApplication app{argc, argv};
+
+    auto args = QCoreApplication::arguments();
+    if (args.size() != 2) {
+        qWarning("usage: pethumbnail-fixtures <output directory>");
+        return 1;
+    }
+
+    QDir dir{args[1]};
+    if (!dir.mkpath(QStringLiteral("."))) {
+        qWarning("Unable to create %s", qPrintable(args[1]));
+        return 1;
+    }
+
+    for (const auto &spec : standardFixtures()) {
+        auto name = spec.name + QStringLiteral(".exe");
+        if (!writeFixture(spec, dir.filePath(name))) {
+            qWarning("Unable to write %s", qPrintable(name));
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -1,80 +1,114 @@
 #include "ne.h"
 
 #include "dib.h"
+#include "layout.h"
+#include "reader.h"
+#include "trace.h"
 
-#include <QDataStream>
+#include <limits>
+
+namespace {
+
+// Real files use shifts of 4 to 9. Anything up to 16 keeps offsets within
+// 32 bits.
+constexpr quint16 MAX_ALIGNMENT_SHIFT = 16;
 
-QDataStream &operator>>(QDataStream &s, NeFileHeader &v) {
-    s.device()->skip(34);
-    s >> v.offsetOfResourceTable;
-    s.device()->skip(14);
-    s >> v.numberOfResourceSegments;
-    return s;
 }
 
-QDataStream &operator>>(QDataStream &s, NeResource &v) {
-    s >> v.dataOffsetShifted 
-      >> v.dataLength 
-      >> v.flags 
-      >> v.resourceId 
-      >> v.resource[0] 
-      >> v.resource[1];
-    v.resourceId ^= 0x8000;
-    return s;
+// Offsets are relative to the end of the "NE" signature.
+template<> struct LayoutOf<NeFileHeader> : Layout<NeFileHeader, 52,
+    Field<34, &NeFileHeader::offsetOfResourceTable>,
+    Field<50, &NeFileHeader::numberOfResourceSegments>> {};
+
+template<> struct LayoutOf<NeResource> : Layout<NeResource, 12,
+    Field<0, &NeResource::dataOffsetShifted>,
+    Field<2, &NeResource::dataLength>,
+    Field<4, &NeResource::flags>,
+    Field<6, &NeResource::resourceId>,
+    Field<8, &NeResource::resource>> {};
+
+ByteReader &operator>>(ByteReader &s, NeFileHeader &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, NeResourceTable::Type &v) {
-    s >> v.typeId;
-    if (v.typeId == 0) {
-        return s;
-    }
-    s >> v.numResources >> v.resource[0] >> v.resource[1];
-    for (int i = 0; i < v.numResources; i++) {
-        NeResource resource;
-        s >> resource;
-        v.resources.append(resource);
-    }
+ByteReader &operator>>(ByteReader &s, NeResource &v) {
+    readStruct(s, v);
+    v.resourceId ^= 0x8000;
     return s;
 }
 
-QDataStream &operator>>(QDataStream &s, NeResourceTable &v) {
-    s >> v.alignmentShiftCount;
-    while(1) {
-        NeResourceTable::Type type;
-        s >> type;
-        if (!type.typeId) { break; }
-        v.types[ResourceType(type.typeId ^ 0x8000)] = type;
+const NeResource *NeResourceTable::find(ResourceType type, int &count) const {
+    // A type listed twice is taken from its last entry.
+    for (auto it = types.crbegin(); it != types.crend(); ++it) {
+        if (it->type == type) {
+            count = it->numResources;
+            return count ? resources.data() + it->first : nullptr;
+        }
     }
-    return s;
+    count = 0;
+    return nullptr;
 }
 
 bool NewExecutableResourceReader::parseHeaders() {
-    if (!ds.device()->seek(dosHeader.newHeaderOffset)) {
+    if (!reader.seek(dosHeader.newHeaderOffset)) {
         return false;
     }
 
     char signature[2];
-    ds.readRawData(signature, sizeof(signature));
+    reader.readRawData(signature, sizeof(signature));
 
     if (signature[0] != 'N' || signature[1] != 'E') {
         return false;
     }
 
-    ds >> fileHeader;
-    if (!ds.device()->seek(dosHeader.newHeaderOffset + fileHeader.offsetOfResourceTable)) {
+    reader >> fileHeader;
+    if (!reader.seek(dosHeader.newHeaderOffset + fileHeader.offsetOfResourceTable)) {
+        return false;
+    }
+
+    return readResourceTable();
+}
+
+bool NewExecutableResourceReader::readResourceTable() {
+    TraceSpan span{"resources"};
+    reader >> resources.alignmentShiftCount;
+    if (resources.alignmentShiftCount > MAX_ALIGNMENT_SHIFT) {
         return false;
     }
-    
-    ds >> resources;
 
+    // The table ends with a zero type ID. Each type is charged one entry on
+    // top of its resources, so a run of empty types can't loop for long
+    // either.
+    while(1) {
+        quint16 typeId;
+        reader >> typeId;
+        if (!typeId) { break; }
+
+        NeResourceTable::Type type;
+        type.type = ResourceType(typeId ^ 0x8000);
+        reader >> type.numResources >> type.resource[0] >> type.resource[1];
+        if (!budget.spendEntries(1 + type.numResources)) { return false; }
+
+        type.first = int(resources.resources.size());
+        if (!appendArray(reader, type.numResources, resources.resources)) { break; }
+        for (auto i = resources.resources.begin() + type.first; i != resources.resources.end(); ++i) {
+            i->resourceId ^= 0x8000;
+        }
+        resources.types.push_back(type);
+    }
     return true;
 }
 
+qint64 NewExecutableResourceReader::unshift(quint16 value) const {
+    return qint64(value) << resources.alignmentShiftCount;
+}
+
 bool NewExecutableResourceReader::findIconResource(quint32 ordinal, NeResource &out) {
-    if (!resources.types.contains(ResourceType::Icon)) { return {}; }
-    for (auto resource : resources.types[ResourceType::Icon].resources) {
-        if (resource.resourceId == ordinal) {
-            out = resource;
+    int count;
+    auto icons = resources.find(ResourceType::Icon, count);
+    for (int i = 0; i < count; i++) {
+        if (icons[i].resourceId == ordinal) {
+            out = icons[i];
             return true;
         }
     }
@@ -88,30 +122,34 @@ bool NewExecutableResourceReader::getIconInfo(RtGroupIconDirectoryEntry entry, I
         return false;
     }
 
-    info.dataOffset = resource.dataOffsetShifted << resources.alignmentShiftCount;
-    info.dataLength = resource.dataLength;
+    // Both the offset and the length are in units of the alignment. The
+    // length of the last resource may be rounded up past the end of the file.
+    auto offset = unshift(resource.dataOffsetShifted);
+    auto size = reader.source().size();
+    if (offset > size || offset > std::numeric_limits<int>::max()) {
+        return false;
+    }
+    info.dataOffset = int(offset);
+    info.dataLength = int(qMin(unshift(resource.dataLength), size - offset));
 
-    if (!ds.device()->seek(info.dataOffset)) { return {}; }
+    if (!reader.seek(info.dataOffset)) { return {}; }
+    reader.willNeed(info.dataOffset, info.dataLength);
 
     BitmapInfoHeader dibHeader;
-    ds >> dibHeader;
+    reader >> dibHeader;
     info.bpp = dibHeader.biBitCount;
     info.size = {int(dibHeader.biWidth), int(dibHeader.biHeight / 2)};
-    return true;
+    return budget.allowPixels(info.size.width(), qAbs(qint64(info.size.height())));
 }
 
-QVector<IconInfo> NewExecutableResourceReader::readMainIconGroup() {
-    if (!resources.types.contains(ResourceType::GroupIcon)) { return {}; }
-    auto entries = resources.types[ResourceType::GroupIcon];
-    if (entries.resources.empty()) { return {}; }
-    auto res = entries.resources.first(); // App icon should always be first
-    if (!ds.device()->seek(res.dataOffsetShifted << resources.alignmentShiftCount)) { return {}; }
-    QVector<IconInfo> result;
-    for (auto entry : readResourceDirectory(ds)) {
-        IconInfo info;
-        if (getIconInfo(entry, info)) {
-            result.append(info);
-        }
-    }
-    return result;
+ArenaVector<RtGroupIconDirectoryEntry> NewExecutableResourceReader::readMainIconGroup() {
+    ArenaVector<RtGroupIconDirectoryEntry> entries{memory};
+    int count;
+    auto groups = resources.find(ResourceType::GroupIcon, count);
+    if (!groups) { return entries; }
+    const auto &res = groups[0]; // App icon should always be first
+    if (!reader.seek(unshift(res.dataOffsetShifted))) { return entries; }
+    reader.willNeed(reader.pos(), unshift(res.dataLength));
+    readResourceDirectory(reader, entries, &budget);
+    return entries;
 }
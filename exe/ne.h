@@ -1,13 +1,14 @@
 #pragma once
+#include "budget.h"
 #include "common.h"
 #include "exe.h"
 #include "resource.h"
 
 #include <QtGlobal>
-#include <QVector>
-#include <QMap>
 
-class QDataStream;
+#include <memory_resource>
+
+class ByteReader;
 
 struct NeFileHeader {
     quint16 offsetOfResourceTable;
@@ -23,37 +24,53 @@ struct NeResource {
 
 };
 
+// The resources of every type live in one flat array, each type owning a
+// contiguous run of it.
 struct NeResourceTable {
     struct Type {
-        quint16 typeId;
+        ResourceType type;
         quint16 numResources;
         quint16 resource[2];
-        QVector<NeResource> resources;
+        int first;
     };
 
+    explicit NeResourceTable(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : types{memory}, resources{memory} {}
+
+    // Returns the type's resources, or nullptr if there are none.
+    const NeResource *find(ResourceType type, int &count) const;
+
     quint16 alignmentShiftCount;
-    QMap<ResourceType, Type> types;
+    ArenaVector<Type> types;
+    ArenaVector<NeResource> resources;
 };
 
 
-QDataStream &operator>>(QDataStream &s, NeFileHeader &v);
-QDataStream &operator>>(QDataStream &s, NeResource &v);
-QDataStream &operator>>(QDataStream &s, NeResourceTable &v);
-QDataStream &operator>>(QDataStream &s, NeResourceTable::Type &v);
+ByteReader &operator>>(ByteReader &s, NeFileHeader &v);
+ByteReader &operator>>(ByteReader &s, NeResource &v);
 
 
 class NewExecutableResourceReader {
 public:
-    NewExecutableResourceReader(QDataStream *ds, DosHeader dosHeader)
-        : ds{*ds}, dosHeader{dosHeader} {}
+    // Parser state is allocated from `memory`, and the work done is charged to
+    // `budget`.
+    NewExecutableResourceReader(ByteReader *reader, DosHeader dosHeader, ParseBudget *budget,
+                                std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : reader{*reader}, budget{*budget}, memory{memory}, dosHeader{dosHeader}, resources{memory} {}
 
     bool parseHeaders();
     bool findIconResource(quint32 ordinal, NeResource &out);
     bool getIconInfo(RtGroupIconDirectoryEntry entry, IconInfo &info);
-    QVector<IconInfo> readMainIconGroup();
+    ArenaVector<RtGroupIconDirectoryEntry> readMainIconGroup();
 
 private:
-    QDataStream &ds;
+    bool readResourceTable();
+    // Converts a value in units of the resource alignment to bytes.
+    qint64 unshift(quint16 value) const;
+
+    ByteReader &reader;
+    ParseBudget &budget;
+    std::pmr::memory_resource *memory;
 
     DosHeader dosHeader;
     NeFileHeader fileHeader;
@@ -2,100 +2,136 @@
 
 #include "common.h"
 #include "dib.h"
+#include "layout.h"
+#include "png.h"
+#include "reader.h"
+#include "trace.h"
 
-#include <QDataStream>
-#include <QImageReader>
+#include <algorithm>
+#include <limits>
 
 namespace {
 
-constexpr quint16 OPTIONAL_HEADER_MAGIC_PE32 = 0x010b;
-constexpr quint16 OPTIONAL_HEADER_MAGIC_PE32_PLUS = 0x020b;
-constexpr quint32 SUBDIR_BIT_MASK = 0x80000000;
-const QByteArray PNG_SIGNATURE{"\x89PNG\x0D\x0A\x1A\x0A",8};
+constexpr qint64 SECTION_HEADER_SIZE = 40;
+
+// The directory tables sit at the start of the resource section, ahead of
+// the data; this is usually enough to cover all of the levels we walk.
+constexpr qint64 RESOURCE_TREE_HINT = 64 * 1024;
 
 }
 
-QDataStream &operator>>(QDataStream &s, PeFileHeader &v) {
-    s >> v.machine >> v.numSections >> v.timestamp
-      >> v.offsetToSymbolTable >> v.numberOfSymbols
-      >> v.sizeOfOptionalHeader >> v.fileCharacteristics;
-    return s;
+template<> struct LayoutOf<PeFileHeader> : Layout<PeFileHeader, 20,
+    Field<0, &PeFileHeader::machine>,
+    Field<2, &PeFileHeader::numSections>,
+    Field<4, &PeFileHeader::timestamp>,
+    Field<8, &PeFileHeader::offsetToSymbolTable>,
+    Field<12, &PeFileHeader::numberOfSymbols>,
+    Field<16, &PeFileHeader::sizeOfOptionalHeader>,
+    Field<18, &PeFileHeader::fileCharacteristics>> {};
+
+template<> struct LayoutOf<PeDataDirectory> : Layout<PeDataDirectory, 8,
+    Field<0, &PeDataDirectory::virtualAddress>,
+    Field<4, &PeDataDirectory::size>> {};
+
+template<> struct LayoutOf<PeSection> : Layout<PeSection, SECTION_HEADER_SIZE,
+    Field<0, &PeSection::name>,
+    Field<8, &PeSection::virtualSize>,
+    Field<12, &PeSection::virtualAddress>,
+    Field<16, &PeSection::sizeOfRawData>,
+    Field<20, &PeSection::pointerToRawData>,
+    Field<24, &PeSection::pointerToRelocs>,
+    Field<28, &PeSection::pointerToLineNums>,
+    Field<32, &PeSection::numRelocs>,
+    Field<34, &PeSection::numLineNums>,
+    Field<36, &PeSection::characteristics>> {};
+
+template<> struct LayoutOf<PeResourceDirectoryTable> : Layout<PeResourceDirectoryTable, 16,
+    Field<0, &PeResourceDirectoryTable::characteristics>,
+    Field<4, &PeResourceDirectoryTable::timestamp>,
+    Field<8, &PeResourceDirectoryTable::majorVersion>,
+    Field<10, &PeResourceDirectoryTable::minorVersion>,
+    Field<12, &PeResourceDirectoryTable::numNameEntries>,
+    Field<14, &PeResourceDirectoryTable::numIDEntries>> {};
+
+template<> struct LayoutOf<PeResourceDirectoryEntry> : Layout<PeResourceDirectoryEntry, 8,
+    Field<0, &PeResourceDirectoryEntry::ordinalOrNameOffset>,
+    Field<4, &PeResourceDirectoryEntry::dataOrSubdirOffset>> {};
+
+template<> struct LayoutOf<PeResourceDataEntry> : Layout<PeResourceDataEntry, 16,
+    Field<0, &PeResourceDataEntry::dataAddress>,
+    Field<4, &PeResourceDataEntry::size>,
+    Field<8, &PeResourceDataEntry::codepage>,
+    Field<12, &PeResourceDataEntry::reserved>> {};
+
+ByteReader &operator>>(ByteReader &s, PeFileHeader &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, PeDataDirectory &v) {
-    s >> v.virtualAddress >> v.size;
-    return s;
+ByteReader &operator>>(ByteReader &s, PeDataDirectory &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, PeSection &v) {
-    s.readRawData(v.name, sizeof(v.name));
-    s >> v.virtualSize >> v.virtualAddress
-      >> v.sizeOfRawData >> v.pointerToRawData
-      >> v.pointerToRelocs >> v.pointerToLineNums
-      >> v.numRelocs >> v.numLineNums
-      >> v.characteristics;
-    return s;
+ByteReader &operator>>(ByteReader &s, PeSection &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, PeResourceDirectoryTable &v) {
-    s >> v.characteristics >> v.timestamp
-      >> v.majorVersion >> v.minorVersion
-      >> v.numNameEntries >> v.numIDEntries;
-    return s;
+ByteReader &operator>>(ByteReader &s, PeResourceDirectoryTable &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, PeResourceDirectoryEntry &v) {
-    s >> v.ordinalOrNameOffset >> v.dataOrSubdirOffset;
-    return s;
+ByteReader &operator>>(ByteReader &s, PeResourceDirectoryEntry &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, PeResourceDataEntry &v) {
-    s >> v.dataAddress >> v.size >> v.codepage >> v.reserved;
-    return s;
+ByteReader &operator>>(ByteReader &s, PeResourceDataEntry &v) {
+    return readStruct(s, v);
 }
 
 qint64 PortableExecutableResourceReader::addressToOffset(quint32 rva) {
-    for (int i = 0; i < sections.size(); i++) {
-        auto sectionBegin = sections[i].virtualAddress;
-        auto sectionEnd = sections[i].virtualAddress + sections[i].sizeOfRawData;
-        if (rva >= sectionBegin && rva < sectionEnd) {
-            return rva - sectionBegin + sections[i].pointerToRawData;
-        }
+    auto it = std::upper_bound(sections.cbegin(), sections.cend(), rva, [](quint32 rva, const SectionRange &section) {
+        return rva < section.begin;
+    });
+    if (it == sections.cbegin()) {
+        return -1;
+    }
+    --it;
+    if (rva >= it->end) {
+        return -1;
     }
-    return -1;
+    return rva - it->begin + it->pointerToRawData;
 }
 
 bool PortableExecutableResourceReader::seekToAddress(quint32 rva) {
-    return ds.device()->seek(addressToOffset(rva));
+    return reader.seek(addressToOffset(rva));
 }
 
 bool PortableExecutableResourceReader::parseHeaders() {
     // Seek to + verify PE header. We're at the file header after this.
-    if (!ds.device()->seek(dosHeader.newHeaderOffset)) {
+    if (!reader.seek(dosHeader.newHeaderOffset)) {
         return false;
     }
 
     char signature[4];
-    ds.readRawData(signature, sizeof(signature));
+    reader.readRawData(signature, sizeof(signature));
 
     if (signature[0] != 'P' || signature[1] != 'E' || signature[2] != 0 || signature[3] != 0) {
         return false;
     }
 
-    ds >> fileHeader;
+    reader >> fileHeader;
 
     // Read optional header magic to determine if this is PE32 or PE32+.
     // We don't really care about most of the optional header.
     quint16 optMagic;
-    ds >> optMagic;
+    reader >> optMagic;
 
     switch (optMagic) {
     case OPTIONAL_HEADER_MAGIC_PE32:
-        isPe32Plus = false;
+        pe32Plus = false;
         break;
 
     case OPTIONAL_HEADER_MAGIC_PE32_PLUS:
-        isPe32Plus = true;
+        pe32Plus = true;
         break;
 
     default:
@@ -103,15 +139,31 @@ bool PortableExecutableResourceReader::parseHeaders() {
     }
 
     // We need to read the section table to be able to convert RVAs to file offsets.
-    if (!ds.device()->seek(dosHeader.newHeaderOffset + 24 + fileHeader.sizeOfOptionalHeader)) {
+    if (!reader.seek(dosHeader.newHeaderOffset + 24 + fileHeader.sizeOfOptionalHeader)) {
         return false;
     }
+    if (!budget.spendEntries(fileHeader.numSections)) {
+        return false;
+    }
+    reader.willNeed(reader.pos(), fileHeader.numSections * SECTION_HEADER_SIZE);
 
+    // Decoded one at a time; only the ranges are kept.
+    auto table = reader.read(qint64(fileHeader.numSections) * SECTION_HEADER_SIZE);
+    if (!table) {
+        return false;
+    }
+    sections.reserve(fileHeader.numSections);
     for (int i = 0; i < fileHeader.numSections; i++) {
         PeSection section;
-        ds >> section;
-        sections.append(section);
+        LayoutOf<PeSection>::decode(table + i * SECTION_HEADER_SIZE, section);
+        if (section.sizeOfRawData == 0) {
+            continue;
+        }
+        sections.push_back({section.virtualAddress, section.virtualAddress + section.sizeOfRawData, section.pointerToRawData});
     }
+    std::stable_sort(sections.begin(), sections.end(), [](const SectionRange &a, const SectionRange &b) {
+        return a.begin < b.begin;
+    });
 
     // Read resource tree, too.
     if (!parseResourcesTree()) {
@@ -122,113 +174,136 @@ bool PortableExecutableResourceReader::parseHeaders() {
 }
 
 bool PortableExecutableResourceReader::parseResourcesTree() {
+    TraceSpan span{"resources"};
     auto resourceDirectory = readDataDirectoryEntry(PeDataDirectoryIndex::Resource);
-    auto resourceOffset = addressToOffset(resourceDirectory.virtualAddress);
+    resourceOffset = addressToOffset(resourceDirectory.virtualAddress);
     if (resourceOffset < 0) {
         return false;
     }
-    if (!ds.device()->seek(resourceOffset)) { return false; }
+    if (!reader.seek(resourceOffset)) { return false; }
+    reader.willNeed(resourceOffset, qMin<qint64>(resourceDirectory.size, RESOURCE_TREE_HINT));
 
     auto level1 = readResourceDataDirectoryEntry();
 
-    for (auto entry1 : level1.entries) {
+    // Only the icon and icon group subtrees are visited; string tables,
+    // dialogs, version info and the like are never read.
+    for (const auto &entry1 : level1.entries) {
+        auto resType = ResourceType(entry1.id.ordinal);
+        if (resType != ResourceType::Icon && resType != ResourceType::GroupIcon) continue;
+
         {
             // Ignore top-level resources, if any exist.
             if ((entry1.dataOrSubdirOffset & SUBDIR_BIT_MASK) == 0) continue;
             auto subdirOffset = entry1.dataOrSubdirOffset & ~SUBDIR_BIT_MASK;
-            if (!ds.device()->seek(resourceOffset + subdirOffset)) { return false; }
+            if (!reader.seek(resourceOffset + subdirOffset)) { return false; }
         }
 
-        auto resType = ResourceType(entry1.id.ordinal);
-        QVector<Resource> resourcesForType;
-
         // Read subdirectory.
         auto level2 = readResourceDataDirectoryEntry();
 
-        for (auto entry2 : level2.entries) {
-            {
+        if (resType == ResourceType::GroupIcon) {
+            // App icon should always be the first group.
+            for (const auto &entry2 : level2.entries) {
                 // Ignore second-level resources, if any exist.
                 if ((entry2.dataOrSubdirOffset & SUBDIR_BIT_MASK) == 0) continue;
                 auto subdirOffset = entry2.dataOrSubdirOffset & ~SUBDIR_BIT_MASK;
-                if (!ds.device()->seek(resourceOffset + subdirOffset)) { return false; }
+                if (readLanguageEntry(entry1.id, entry2.id, subdirOffset, mainGroup)) {
+                    hasMainGroup = true;
+                    break;
+                }
             }
+            continue;
+        }
 
-            // Read subdirectory.
-            auto level3 = readResourceDataDirectoryEntry();
+        icons.clear();
+        icons.reserve(level2.entries.size());
+        for (const auto &entry2 : level2.entries) {
+            if ((entry2.dataOrSubdirOffset & SUBDIR_BIT_MASK) == 0) continue;
+            icons.push_back({entry2.id.ordinal, entry2.dataOrSubdirOffset & ~SUBDIR_BIT_MASK});
+        }
+        std::stable_sort(icons.begin(), icons.end(), [](const IconEntry &a, const IconEntry &b) {
+            return a.ordinal < b.ordinal;
+        });
+    }
 
-            for (auto entry3 : level3.entries) {
-                {
-                    // Ignore deeper subdirectories.
-                    if ((entry3.dataOrSubdirOffset & SUBDIR_BIT_MASK) == SUBDIR_BIT_MASK) continue;
-                    auto dataOffset = entry3.dataOrSubdirOffset & ~SUBDIR_BIT_MASK;
-                    if (!ds.device()->seek(resourceOffset + dataOffset)) { return false; }
-                }
+    return true;
+}
 
-                // Read data.
-                PeResourceDataEntry dataEntry;
-                ds >> dataEntry;
+bool PortableExecutableResourceReader::readLanguageEntry(ResourceId type, ResourceId name, quint32 subdirOffset, Resource &out) {
+    if (!reader.seek(resourceOffset + subdirOffset)) { return false; }
 
-                Resource resource;
-                resource.id1.ordinal = entry1.id.ordinal;
-                resource.id2.ordinal = entry2.id.ordinal;
-                resource.id3.ordinal = entry3.id.ordinal;
-                resource.entry = dataEntry;
-                resourcesForType.append(resource);
-            }
-        }
+    // Read subdirectory; the first language wins.
+    auto level3 = readResourceDataDirectoryEntry();
 
-        resources[resType] = resourcesForType;
+    for (const auto &entry3 : level3.entries) {
+        // Ignore deeper subdirectories.
+        if ((entry3.dataOrSubdirOffset & SUBDIR_BIT_MASK) == SUBDIR_BIT_MASK) continue;
+        auto dataOffset = entry3.dataOrSubdirOffset & ~SUBDIR_BIT_MASK;
+        if (!reader.seek(resourceOffset + dataOffset)) { return false; }
+
+        out.id1 = type;
+        out.id2 = name;
+        out.id3 = entry3.id;
+        reader >> out.entry;
+        return true;
     }
 
-    return true;
+    return false;
 }
 
 ResourceDir PortableExecutableResourceReader::readResourceDataDirectoryEntry() {
     PeResourceDirectoryTable table;
-    ds >> table;
-    QVector<ResourceDir::Entry> entries;
-    for (int i = 0; i < table.numNameEntries; i++) {
-        PeResourceDirectoryEntry entry;
-        ds >> entry;
-        entries.append({{entry.ordinalOrNameOffset}, entry.dataOrSubdirOffset});
+    reader >> table;
+
+    // Named entries come first, followed by the ID entries.
+    int count = table.numNameEntries + table.numIDEntries;
+    ResourceDir dir{ArenaVector<ResourceDir::Entry>{memory}};
+    if (!budget.spendEntries(count)) {
+        return dir;
     }
-    for (int i = 0; i < table.numIDEntries; i++) {
+
+    auto raw = reader.read(qint64(count) * LayoutOf<PeResourceDirectoryEntry>::size);
+    if (!raw) {
+        return dir;
+    }
+    dir.entries.resize(count);
+    for (int i = 0; i < count; i++, raw += LayoutOf<PeResourceDirectoryEntry>::size) {
         PeResourceDirectoryEntry entry;
-        ds >> entry;
-        entries.append({{entry.ordinalOrNameOffset}, entry.dataOrSubdirOffset});
+        LayoutOf<PeResourceDirectoryEntry>::decode(raw, entry);
+        dir.entries[i] = {{entry.ordinalOrNameOffset}, entry.dataOrSubdirOffset};
     }
-    return {entries};
+    return dir;
 }
 
 PeDataDirectory PortableExecutableResourceReader::readDataDirectoryEntry(PeDataDirectoryIndex index) {
     qint64 dataDirOffset = dosHeader.newHeaderOffset + 0x78 + qint64(index) * 0x8;
 
     // On PE32+, this is 0x10 bytes further down.
-    if (isPe32Plus) { dataDirOffset += 0x10; }
+    if (pe32Plus) { dataDirOffset += 0x10; }
 
-    ds.device()->seek(dataDirOffset);
+    reader.seek(dataDirOffset);
 
     PeDataDirectory directory;
-    ds >> directory;
+    reader >> directory;
     return directory;
 }
 
 bool PortableExecutableResourceReader::findIconResource(quint32 ordinal, Resource &out) {
-    if (!resources.contains(ResourceType::Icon)) { return false; }
-
-    for (auto res : resources[ResourceType::Icon]) {
-        if (res.id2.ordinal == ordinal) {
-            out = res;
-            return true;
-        }
+    auto it = std::lower_bound(icons.cbegin(), icons.cend(), ordinal, [](const IconEntry &icon, quint32 ordinal) {
+        return icon.ordinal < ordinal;
+    });
+    if (it == icons.cend() || it->ordinal != ordinal) {
+        return false;
     }
 
-    return false;
+    return readLanguageEntry({quint32(ResourceType::Icon)}, {ordinal}, it->subdirOffset, out);
 }
 
 QByteArray PortableExecutableResourceReader::readResource(Resource res) {
     if (!seekToAddress(res.entry.dataAddress)) { return {}; }
-    return ds.device()->read(res.entry.size);
+    auto data = reader.read(res.entry.size);
+    if (!data) { return {}; }
+    return QByteArray{reinterpret_cast<const char *>(data), int(res.entry.size)};
 }
 
 bool PortableExecutableResourceReader::getIconInfo(RtGroupIconDirectoryEntry entry, IconInfo &info) {
@@ -238,39 +313,41 @@ bool PortableExecutableResourceReader::getIconInfo(RtGroupIconDirectoryEntry ent
         return false;
     }
 
-    info.dataOffset = addressToOffset(resource.entry.dataAddress);
-    info.dataLength = resource.entry.size;
-
-    if (!ds.device()->seek(info.dataOffset)) { return false; }
-
-    if (ds.device()->peek(8).startsWith(PNG_SIGNATURE)) {
-        QImageReader r{ds.device(), "PNG"};
-        info.bpp = 32;
-        info.size = r.size();
+    auto offset = addressToOffset(resource.entry.dataAddress);
+    if (offset < 0 || offset > std::numeric_limits<int>::max() ||
+        resource.entry.size > quint32(std::numeric_limits<int>::max())) {
+        return false;
+    }
+    info.dataOffset = int(offset);
+    info.dataLength = int(resource.entry.size);
+
+    if (!reader.seek(info.dataOffset)) { return false; }
+    reader.willNeed(info.dataOffset, info.dataLength);
+
+    auto headerSize = qMin<qint64>(PNG_HEADER_SIZE, info.dataLength);
+    auto header = reader.peek(headerSize);
+    if (header && hasPngSignature(header, headerSize)) {
+        PngHeader png;
+        if (!readPngHeader(header, headerSize, png)) { return false; }
+        info.bpp = png.bpp();
+        info.size = {int(png.width), int(png.height)};
         info.png = true;
-        return true;
+        return budget.allowPixels(png.width, png.height);
     }
 
     BitmapInfoHeader dibHeader;
-    ds >> dibHeader;
+    reader >> dibHeader;
     info.bpp = dibHeader.biBitCount;
     info.size = {int(dibHeader.biWidth), int(dibHeader.biHeight / 2)};
     info.png = false;
-    return true;
+    return budget.allowPixels(info.size.width(), qAbs(qint64(info.size.height())));
 }
 
-QVector<IconInfo> PortableExecutableResourceReader::readMainIconGroup() {
-    if (!resources.contains(ResourceType::GroupIcon)) { return {}; }
-    auto entries = resources[ResourceType::GroupIcon];
-    if (entries.empty()) { return {}; }
-    auto res = entries.first(); // App icon should always be first
-    if (!seekToAddress(res.entry.dataAddress)) { return {}; }
-    QVector<IconInfo> result;
-    for (auto entry : readResourceDirectory(ds)) {
-        IconInfo info;
-        if (getIconInfo(entry, info)) {
-            result.append(info);
-        }
-    }
-    return result;
+ArenaVector<RtGroupIconDirectoryEntry> PortableExecutableResourceReader::readMainIconGroup() {
+    ArenaVector<RtGroupIconDirectoryEntry> entries{memory};
+    if (!hasMainGroup) { return entries; }
+    if (!seekToAddress(mainGroup.entry.dataAddress)) { return entries; }
+    reader.willNeed(reader.pos(), mainGroup.entry.size);
+    readResourceDirectory(reader, entries, &budget);
+    return entries;
 }
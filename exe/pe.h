@@ -1,13 +1,22 @@
 #pragma once
+#include "budget.h"
 #include "common.h"
 #include "exe.h"
 #include "resource.h"
 
 #include <QtGlobal>
-#include <QMap>
-#include <QVector>
 
-class QDataStream;
+#include <memory_resource>
+
+class ByteReader;
+
+// The first field of the optional header, which tells the two layouts apart.
+constexpr quint16 OPTIONAL_HEADER_MAGIC_PE32 = 0x010b;
+constexpr quint16 OPTIONAL_HEADER_MAGIC_PE32_PLUS = 0x020b;
+
+// Set in a resource directory entry's offset when it points at another
+// directory rather than at a data entry.
+constexpr quint32 SUBDIR_BIT_MASK = 0x80000000;
 
 enum class PeDataDirectoryIndex {
     Resource = 2,
@@ -62,11 +71,11 @@ struct PeResourceDataEntry {
     quint32 reserved;
 };
 
-QDataStream &operator>>(QDataStream &s, PeFileHeader &v);
-QDataStream &operator>>(QDataStream &s, PeDataDirectory &v);
-QDataStream &operator>>(QDataStream &s, PeResourceDirectoryTable &v);
-QDataStream &operator>>(QDataStream &s, PeResourceDirectoryEntry &v);
-QDataStream &operator>>(QDataStream &s, PeResourceDataEntry &v);
+ByteReader &operator>>(ByteReader &s, PeFileHeader &v);
+ByteReader &operator>>(ByteReader &s, PeDataDirectory &v);
+ByteReader &operator>>(ByteReader &s, PeResourceDirectoryTable &v);
+ByteReader &operator>>(ByteReader &s, PeResourceDirectoryEntry &v);
+ByteReader &operator>>(ByteReader &s, PeResourceDataEntry &v);
 
 class PortableExecutableResourceReader {
 public:
@@ -75,27 +84,51 @@ public:
         PeResourceDataEntry entry;
     };
 
-    PortableExecutableResourceReader(QDataStream *ds, DosHeader dosHeader)
-        : ds{*ds}, dosHeader{dosHeader} {}
+    // Parser state is allocated from `memory`, and the work done is charged to
+    // `budget`.
+    PortableExecutableResourceReader(ByteReader *reader, DosHeader dosHeader, ParseBudget *budget,
+                                     std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : reader{*reader}, budget{*budget}, memory{memory}, dosHeader{dosHeader}, sections{memory}, icons{memory} {}
 
     qint64 addressToOffset(quint32 rva);
     bool seekToAddress(quint32 rva);
     bool parseHeaders();
+    bool isPe32Plus() const { return pe32Plus; }
     bool parseResourcesTree();
     ResourceDir readResourceDataDirectoryEntry();
     PeDataDirectory readDataDirectoryEntry(PeDataDirectoryIndex index);
+    bool readLanguageEntry(ResourceId type, ResourceId name, quint32 subdirOffset, Resource &out);
     bool findIconResource(quint32 ordinal, Resource &out);
     QByteArray readResource(Resource res);
     bool getIconInfo(RtGroupIconDirectoryEntry entry, IconInfo &info);
-    QVector<IconInfo> readMainIconGroup();
+    ArenaVector<RtGroupIconDirectoryEntry> readMainIconGroup();
 
 private:
-    QDataStream &ds;
+    ByteReader &reader;
+    ParseBudget &budget;
+    std::pmr::memory_resource *memory;
 
     DosHeader dosHeader;
     PeFileHeader fileHeader;
-    bool isPe32Plus;
+    bool pe32Plus;
+
+    // Raw section extents sorted by virtual address, for RVA translation.
+    struct SectionRange {
+        quint32 begin;
+        quint32 end;
+        quint32 pointerToRawData;
+    };
+
+    // RT_ICON name-level entries sorted by ordinal. The language level below
+    // each one is only read when that icon is looked up.
+    struct IconEntry {
+        quint32 ordinal;
+        quint32 subdirOffset;
+    };
 
-    QVector<PeSection> sections;
-    QMap<ResourceType, QVector<Resource>> resources;
+    ArenaVector<SectionRange> sections;
+    qint64 resourceOffset = -1;
+    ArenaVector<IconEntry> icons;
+    Resource mainGroup;
+    bool hasMainGroup = false;
 };
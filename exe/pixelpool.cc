@@ -0,0 +1,161 @@
+#include "pixelpool.h"
+
+#include <QMutex>
+
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+// 32x32 ARGB32 up to 256x256 ARGB32.
+constexpr int MIN_CLASS_SHIFT = 12;
+constexpr int MAX_CLASS_SHIFT = 18;
+constexpr int CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+// Keeps the pixels after the header aligned for the SIMD line converters.
+constexpr qint64 HEADER_SIZE = 64;
+
+int sizeClassFor(qint64 bytes) {
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (bytes <= qint64(1) << (MIN_CLASS_SHIFT + i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+qint64 classBytes(int sizeClass) {
+    return qint64(1) << (MIN_CLASS_SHIFT + sizeClass);
+}
+
+}
+
+// Outlives the pool for as long as any of its buffers is still held by an
+// image, so that images can be released in any order.
+struct PixelPool::Shared {
+    // Sits at the front of every buffer, which is what the image's cleanup
+    // function gets back.
+    struct Header {
+        Shared *shared;
+        int sizeClass;
+    };
+
+    explicit Shared(qint64 maxFreeBytes) : maxFreeBytes{maxFreeBytes} {}
+
+    void releaseFree() {
+        for (auto &list : free) {
+            for (auto buffer : list) {
+                std::free(buffer);
+            }
+            list.clear();
+        }
+        counters.bytesFree = 0;
+    }
+
+    uchar *take(int sizeClass) {
+        QMutexLocker locker{&mutex};
+        auto bytes = classBytes(sizeClass);
+        Header *header;
+        auto &list = free[sizeClass];
+        if (!list.empty()) {
+            header = list.back();
+            list.pop_back();
+            counters.bytesFree -= bytes;
+            counters.hits++;
+        } else {
+            header = static_cast<Header *>(std::aligned_alloc(HEADER_SIZE, HEADER_SIZE + bytes));
+            if (!header) {
+                return nullptr;
+            }
+            header->shared = this;
+            header->sizeClass = sizeClass;
+            counters.misses++;
+        }
+        counters.bytesInUse += bytes;
+        counters.peakBytes = qMax(counters.peakBytes, counters.bytesInUse + counters.bytesFree);
+        references++;
+        return reinterpret_cast<uchar *>(header) + HEADER_SIZE;
+    }
+
+    static void release(void *info) {
+        auto header = static_cast<Header *>(info);
+        auto shared = header->shared;
+        bool last;
+        {
+            QMutexLocker locker{&shared->mutex};
+            auto bytes = classBytes(header->sizeClass);
+            shared->counters.bytesInUse -= bytes;
+            if (shared->open && shared->counters.bytesFree + bytes <= shared->maxFreeBytes) {
+                shared->free[header->sizeClass].push_back(header);
+                shared->counters.bytesFree += bytes;
+            } else {
+                std::free(header);
+            }
+            last = --shared->references == 0;
+        }
+        if (last) {
+            delete shared;
+        }
+    }
+
+    // Releases the free buffers and drops the pool's own reference; buffers
+    // still out free themselves on return.
+    static void close(Shared *shared) {
+        bool last;
+        {
+            QMutexLocker locker{&shared->mutex};
+            shared->open = false;
+            shared->releaseFree();
+            last = --shared->references == 0;
+        }
+        if (last) {
+            delete shared;
+        }
+    }
+
+    QMutex mutex;
+    std::vector<Header *> free[CLASS_COUNT];
+    qint64 maxFreeBytes;
+    Stats counters;
+    int references = 1;
+    bool open = true;
+};
+
+PixelPool::PixelPool(qint64 maxFreeBytes)
+    : shared{new Shared{maxFreeBytes}}
+{
+}
+
+PixelPool::~PixelPool() {
+    Shared::close(shared);
+}
+
+QImage PixelPool::image(QSize size, QImage::Format format) {
+    if (size.isEmpty()) {
+        return {};
+    }
+
+    // Same row padding as QImage's own allocations.
+    int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    qint64 bytesPerLine = ((qint64(size.width()) * depth + 31) >> 5) << 2;
+    int sizeClass = sizeClassFor(bytesPerLine * size.height());
+    if (sizeClass < 0) {
+        return QImage{size, format};
+    }
+
+    auto data = shared->take(sizeClass);
+    if (!data) {
+        return {};
+    }
+    return QImage{data, size.width(), size.height(), int(bytesPerLine), format,
+                  &Shared::release, data - HEADER_SIZE};
+}
+
+PixelPool::Stats PixelPool::stats() const {
+    QMutexLocker locker{&shared->mutex};
+    return shared->counters;
+}
+
+QImage allocateImage(PixelPool *pool, QSize size, QImage::Format format) {
+    return pool ? pool->image(size, format) : QImage{size, format};
+}
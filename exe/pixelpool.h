@@ -0,0 +1,45 @@
+#pragma once
+#include <QtGlobal>
+#include <QImage>
+#include <QSize>
+
+// Recycled pixel memory for decoded icons.
+//
+// Buffers come in power-of-two size classes up to the size of a 256x256
+// ARGB32 icon. Images made by the pool wrap one of its buffers, which goes
+// back to the pool, rather than to the allocator, once the last copy of the
+// image is gone. A long-lived worker thus settles on a fixed set of buffers
+// instead of mapping and unmapping them for every file. Images may outlive
+// the pool. Safe to share between threads.
+class PixelPool {
+public:
+    struct Stats {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        // Handed out and not yet returned, and kept for reuse.
+        qint64 bytesInUse = 0;
+        qint64 bytesFree = 0;
+        // The most the two have added up to at any one time.
+        qint64 peakBytes = 0;
+    };
+
+    // Returned buffers beyond `maxFreeBytes` are released.
+    explicit PixelPool(qint64 maxFreeBytes = 4 * 1024 * 1024);
+    ~PixelPool();
+
+    PixelPool(const PixelPool &) = delete;
+    PixelPool &operator=(const PixelPool &) = delete;
+
+    // An uninitialized image, backed by pooled memory when it fits in a size
+    // class and by a plain allocation otherwise.
+    QImage image(QSize size, QImage::Format format);
+
+    Stats stats() const;
+
+private:
+    struct Shared;
+    Shared *shared;
+};
+
+// pool->image() when there is a pool, a plain QImage otherwise.
+QImage allocateImage(PixelPool *pool, QSize size, QImage::Format format);
@@ -0,0 +1,81 @@
+#include "png.h"
+#include "pixelpool.h"
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QImage>
+#include <QImageReader>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+constexpr char SIGNATURE[8] = {'\x89', 'P', 'N', 'G', '\x0D', '\x0A', '\x1A', '\x0A'};
+constexpr quint32 IHDR_LENGTH = 13;
+constexpr quint8 COLOR_TYPE_RGBA = 6;
+
+// Far beyond any icon; the spec allows up to 2^31 - 1.
+constexpr quint32 MAX_DIMENSION = 1 << 16;
+
+}
+
+int PngHeader::bpp() const {
+    switch (colorType) {
+    case 0: return bitDepth;        // grayscale
+    case 2: return bitDepth * 3;    // RGB
+    case 3: return bitDepth;        // palette
+    case 4: return bitDepth * 2;    // grayscale + alpha
+    case 6: return bitDepth * 4;    // RGBA
+    }
+    return 0;
+}
+
+bool hasPngSignature(const uchar *data, qint64 size) {
+    return size >= qint64(sizeof(SIGNATURE)) && std::memcmp(data, SIGNATURE, sizeof(SIGNATURE)) == 0;
+}
+
+bool readPngHeader(const uchar *data, qint64 size, PngHeader &out) {
+    if (size < PNG_HEADER_SIZE || !hasPngSignature(data, size)) {
+        return false;
+    }
+
+    auto chunk = data + sizeof(SIGNATURE);
+    if (qFromBigEndian<quint32>(chunk) != IHDR_LENGTH || std::memcmp(chunk + 4, "IHDR", 4) != 0) {
+        return false;
+    }
+
+    auto ihdr = chunk + 8;
+    out.width = qFromBigEndian<quint32>(ihdr);
+    out.height = qFromBigEndian<quint32>(ihdr + 4);
+    out.bitDepth = ihdr[8];
+    out.colorType = ihdr[9];
+    return out.width > 0 && out.height > 0 && out.width <= MAX_DIMENSION && out.height <= MAX_DIMENSION &&
+           out.bpp() > 0;
+}
+
+bool decodePng(const uchar *data, qint64 size, QImage &image, QSize targetSize, PixelPool *pool) {
+    PngHeader header;
+    if (!readPngHeader(data, size, header)) {
+        return false;
+    }
+
+    // The buffer ends at the resource, so the reader can't run past it.
+    auto bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size));
+    QBuffer buffer{&bytes};
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader{&buffer, "PNG"};
+
+    // Scaling in the reader lands the pixels in an image of the final size,
+    // rather than handing back a full-size copy to be scaled later.
+    QSize iconSize{int(header.width), int(header.height)};
+    if (targetSize.isValid() && (iconSize.width() > targetSize.width() || iconSize.height() > targetSize.height())) {
+        reader.setScaledSize(iconSize.scaled(targetSize, Qt::KeepAspectRatio).expandedTo({1, 1}));
+    } else if (pool && header.colorType == COLOR_TYPE_RGBA && header.bitDepth == 8) {
+        // The PNG handler decodes into the image it is given when the size
+        // and format already match, which they do for 8-bit RGBA.
+        image = pool->image(iconSize, QImage::Format_ARGB32);
+    }
+
+    return reader.read(&image);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <QtGlobal>
+#include <QSize>
+
+class PixelPool;
+class QImage;
+
+// The PNG signature plus the IHDR chunk that must follow it.
+constexpr qint64 PNG_HEADER_SIZE = 8 + 8 + 13;
+
+struct PngHeader {
+    quint32 width;
+    quint32 height;
+    quint8 bitDepth;
+    quint8 colorType;
+
+    int bpp() const;
+};
+
+bool hasPngSignature(const uchar *data, qint64 size);
+
+// Reads the dimensions and depth straight from the IHDR chunk, without going
+// through an image reader.
+bool readPngHeader(const uchar *data, qint64 size, PngHeader &out);
+
+// Decodes a PNG icon held in memory, never reading past `size`. If
+// `targetSize` is valid and the icon doesn't fit in it, the icon is
+// downscaled to fit as part of the decode. Full-size RGBA icons are decoded
+// into memory from `pool` if one is given.
+bool decodePng(const uchar *data, qint64 size, QImage &image, QSize targetSize = QSize(), PixelPool *pool = nullptr);
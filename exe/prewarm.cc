@@ -0,0 +1,235 @@
+// Pre-generates thumbnails for every Windows executable under a directory
+// tree, straight into the freedesktop.org thumbnail cache
+// (~/.cache/thumbnails/{normal,large,x-large}), so file managers find them
+// there on the first visit.
+//
+//     pethumbnail-prewarm /srv/software
+//
+// Thumbnails are named after the MD5 of the file's URI and carry Thumb::URI
+// and Thumb::MTime, as the Thumbnail Managing Standard asks. Ones that are
+// still fresh are left alone, so reruns only pay for what changed. Files
+// without an icon go into the plugin's index of them, and are skipped on
+// reruns as long as they don't change.
+
+#include "batch.h"
+#include "exeutil.h"
+#include "iconcache.h"
+#include "thumbindex.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QImageReader>
+#include <QMimeDatabase>
+#include <QMutex>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QUrl>
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+struct Flavor {
+    const char *name;
+    int size;
+};
+
+constexpr Flavor FLAVORS[] = {
+    {"normal", 128},
+    {"large", 256},
+    {"x-large", 512},
+    {"xx-large", 1024},
+};
+
+// The MIME type the KIO plugin is registered for.
+const QString EXECUTABLE_MIME_TYPE = QStringLiteral("application/x-ms-dos-executable");
+
+struct Source {
+    QString path;
+    QByteArray uri;
+    QString thumbnailName;
+    qint64 mtime;
+};
+
+// A thumbnail is fresh if it was made from this URI at this mtime. Only the
+// PNG header and text chunks are read, not the pixels.
+bool isFresh(const QString &thumbnailPath, const Source &source) {
+    QImageReader reader{thumbnailPath, "PNG"};
+    if (!reader.canRead()) {
+        return false;
+    }
+    return reader.text(QStringLiteral("Thumb::URI")).toUtf8() == source.uri &&
+           reader.text(QStringLiteral("Thumb::MTime")).toLongLong() == source.mtime;
+}
+
+// Tags the thumbnail with its source, and writes it readable by the owner
+// only, as the spec asks.
+bool writeCacheThumbnail(QImage image, const QString &path, const Source &source) {
+    image.setText(QStringLiteral("Thumb::URI"), QString::fromUtf8(source.uri));
+    image.setText(QStringLiteral("Thumb::MTime"), QString::number(source.mtime));
+    image.setText(QStringLiteral("Software"), QStringLiteral("pethumbnail-prewarm"));
+    return writeThumbnail(image, path, QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+}
+
+bool makeCacheDir(const QString &path) {
+    if (!QDir{}.mkpath(path)) {
+        return false;
+    }
+    return QFile::setPermissions(path, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner);
+}
+
+}
+
+int main(int argc, char **argv) {
+    QCoreApplication app{argc, argv};
+    QCoreApplication::setApplicationName(QStringLiteral("pethumbnail-prewarm"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Writes thumbnails for Windows executables into the freedesktop.org thumbnail cache."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("paths"), QStringLiteral("Files or directories to scan."), QStringLiteral("<path>..."));
+
+    QCommandLineOption flavorsOption{QStringLiteral("flavors"),
+        QStringLiteral("Comma-separated thumbnail sizes to write: normal, large, x-large, xx-large (default: normal,large,x-large)."),
+        QStringLiteral("flavors"), QStringLiteral("normal,large,x-large")};
+    QCommandLineOption cacheOption{QStringLiteral("cache-dir"),
+        QStringLiteral("Thumbnail cache to write into (default: ~/.cache/thumbnails)."), QStringLiteral("dir")};
+    QCommandLineOption threadsOption{{QStringLiteral("j"), QStringLiteral("threads")},
+        QStringLiteral("Worker threads (default: one per core)."), QStringLiteral("count"), QStringLiteral("0")};
+    parser.addOption(flavorsOption);
+    parser.addOption(cacheOption);
+    parser.addOption(threadsOption);
+    parser.process(app);
+
+    QVector<Flavor> flavors;
+    for (const auto &name : parser.value(flavorsOption).split(QLatin1Char(','))) {
+        auto it = std::find_if(std::begin(FLAVORS), std::end(FLAVORS), [&](const Flavor &flavor) {
+            return name.trimmed() == QLatin1String(flavor.name);
+        });
+        if (it == std::end(FLAVORS)) {
+            qWarning("Unknown flavor: %s", qPrintable(name));
+            return 1;
+        }
+        flavors.append(*it);
+    }
+
+    auto cacheDir = parser.isSet(cacheOption) ? parser.value(cacheOption)
+        : QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/thumbnails");
+    QHash<int, QString> flavorDirs;
+    QVector<QSize> sizes;
+    for (const auto &flavor : flavors) {
+        auto dir = cacheDir + QLatin1Char('/') + QLatin1String(flavor.name);
+        if (!makeCacheDir(cacheDir) || !makeCacheDir(dir)) {
+            qWarning("Unable to create %s", qPrintable(dir));
+            return 1;
+        }
+        flavorDirs.insert(flavor.size, dir);
+        sizes.append({flavor.size, flavor.size});
+    }
+
+    auto paths = parser.positionalArguments();
+    if (paths.isEmpty()) {
+        parser.showHelp(1);
+    }
+
+    // Find the executables with at least one stale thumbnail. Every flavor of
+    // such a file is rewritten, since they all come from the same parse.
+    QMimeDatabase mimeDatabase;
+    ThumbnailIndex index;
+    QVector<Source> sources;
+    QStringList stale;
+    int fresh = 0;
+    int indexedNoIcon = 0;
+    auto consider = [&](const QString &path) {
+        QFileInfo info{path};
+        if (!mimeDatabase.mimeTypeForFile(info).inherits(EXECUTABLE_MIME_TYPE)) {
+            return;
+        }
+
+        Source source;
+        source.path = info.absoluteFilePath();
+        source.uri = QUrl::fromLocalFile(source.path).toEncoded();
+        source.thumbnailName = QString::fromLatin1(QCryptographicHash::hash(source.uri, QCryptographicHash::Md5).toHex()) +
+                               QStringLiteral(".png");
+        source.mtime = info.lastModified().toSecsSinceEpoch();
+
+        ThumbnailKey key;
+        if (ThumbnailKey::forFile(source.path, QSize(), key) && index.hasNoIcon(key)) {
+            indexedNoIcon++;
+            return;
+        }
+
+        bool allFresh = std::all_of(sizes.cbegin(), sizes.cend(), [&](QSize size) {
+            return isFresh(flavorDirs.value(size.width()) + QLatin1Char('/') + source.thumbnailName, source);
+        });
+        if (allFresh) {
+            fresh++;
+            return;
+        }
+        sources.append(source);
+        stale.append(source.path);
+    };
+    for (const auto &path : paths) {
+        if (QFileInfo{path}.isFile()) {
+            consider(path);
+            continue;
+        }
+        QDirIterator it{path, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories};
+        while (it.hasNext()) {
+            consider(it.next());
+        }
+    }
+
+    IconCache icons;
+    BatchOptions options;
+    options.extraction.iconCache = &icons;
+    options.threads = parser.value(threadsOption).toInt();
+    options.concurrentCallback = true;
+
+    std::atomic<int> written{0}, noIcon{indexedNoIcon}, failed{0};
+    // The callback runs on several workers at once, so the directories are
+    // only ever read through a const reference from here on. All flavors of
+    // a file come from one worker, in order, so each file's flag is only
+    // touched by one thread.
+    const auto &dirs = flavorDirs;
+    QVector<char> gotIcon(sources.size(), 0);
+    extractBatch(stale, sizes, options, [&](BatchItem &item) {
+        const auto &source = sources[item.index];
+        auto size = item.targetSize.width();
+        if (item.image.isNull()) {
+            if (item.targetSize != sizes.last() || gotIcon[item.index]) {
+                return;
+            }
+            // Counted once per file, and indexed like the plugin does, so
+            // neither it nor the next run parses the file again.
+            noIcon++;
+            ThumbnailKey key;
+            if (item.stats.permanentFailure && ThumbnailKey::forFile(source.path, QSize(), key)) {
+                index.insertNoIcon(key);
+            }
+            return;
+        }
+        gotIcon[item.index] = 1;
+        auto path = dirs.value(size) + QLatin1Char('/') + source.thumbnailName;
+        if (writeCacheThumbnail(fitThumbnail(item.image, size), path, source)) {
+            written++;
+        } else {
+            failed++;
+            qWarning("Unable to write %s", qPrintable(path));
+        }
+    });
+
+    QTextStream out{stdout};
+    out << stale.size() + fresh << " executables: " << fresh << " already fresh, " << written << " thumbnails written, "
+        << noIcon << " without an icon, " << failed << " failed\n";
+    return failed ? 2 : 0;
+}
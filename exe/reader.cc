@@ -0,0 +1,313 @@
+#include "reader.h"
+
+#include <QFileDevice>
+#include <QIODevice>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int MAX_BLOCKS = 8;
+
+// Hinted ranges at most this far apart are fetched in the same read, up to
+// PREFETCH_BLOCKS blocks at a time so a single read can't flush the cache.
+constexpr qint64 MERGE_GAP = 16 * 1024;
+constexpr int PREFETCH_BLOCKS = 4;
+
+qint64 alignUp(qint64 value, qint64 alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+}
+
+ByteSource::ByteSource(QIODevice *device)
+    : device{device}
+{
+    length = device->size();
+
+    file = qobject_cast<QFileDevice *>(device);
+    if (file && length > 0) {
+        mapping = file->map(0, length);
+        data = mapping;
+    }
+}
+
+ByteSource::ByteSource(const uchar *data, qint64 size)
+    : data{data}, length{size}
+{
+}
+
+ByteSource::~ByteSource() {
+    if (mapping) {
+        file->unmap(mapping);
+    }
+}
+
+void ByteSource::setReadBudget(qint64 bytes) {
+    budget = bytes;
+    overBudget = false;
+}
+
+const uchar *ByteSource::view(qint64 offset, qint64 count) {
+    if (offset < 0 || count < 0 || offset > length || count > length - offset) {
+        return nullptr;
+    }
+    if (count > budget) {
+        overBudget = true;
+        return nullptr;
+    }
+    budget -= count;
+
+    if (data) {
+        counters.bytesRead += count;
+        return data + offset;
+    }
+
+    return viewCached(offset, count);
+}
+
+bool ByteSource::fill(qint64 offset, qint64 count, QByteArray &out) {
+    if (device->isSequential() || device->pos() != offset) {
+        counters.seeks++;
+        if (!device->seek(offset)) {
+            failed = true;
+            return false;
+        }
+    }
+
+    out.resize(count);
+    qint64 n = device->read(out.data(), count);
+    counters.reads++;
+    if (n > 0) {
+        counters.bytesRead += n;
+    }
+    if (n != count) {
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+void ByteSource::willNeed(qint64 offset, qint64 count) {
+    if (offset < 0 || count <= 0 || offset >= length) {
+        return;
+    }
+    count = qMin(count, length - offset);
+    counters.hints++;
+
+    if (mapping) {
+        static const qint64 pageSize = ::sysconf(_SC_PAGESIZE);
+        auto begin = offset & ~(pageSize - 1);
+        ::madvise(mapping + begin, size_t(offset + count - begin), MADV_WILLNEED);
+        return;
+    }
+    if (data) {
+        return;
+    }
+
+    if (file) {
+        ::posix_fadvise(file->handle(), offset, count, POSIX_FADV_WILLNEED);
+    }
+    planned.append({offset, offset + count});
+}
+
+ByteSource::Block *ByteSource::findBlock(qint64 blockOffset) {
+    for (auto &block : blocks) {
+        if (block.offset == blockOffset) {
+            block.lastUse = ++useCounter;
+            if (block.prefetched) {
+                block.prefetched = false;
+                counters.readsSaved++;
+            }
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+ByteSource::Block *ByteSource::takeBlock() {
+    if (blocks.size() < MAX_BLOCKS) {
+        blocks.append(Block{});
+        return &blocks.last();
+    }
+    auto victim = std::min_element(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) {
+        return a.lastUse < b.lastUse;
+    });
+    victim->offset = -1;
+    victim->prefetched = false;
+    return &*victim;
+}
+
+// Extends a read starting at `blockOffset` over the hinted ranges that touch
+// or nearly touch it, and forgets the hints it covers.
+qint64 ByteSource::plannedEnd(qint64 blockOffset) {
+    auto limit = qMin(blockOffset + PREFETCH_BLOCKS * BLOCK_SIZE, length);
+    auto end = qMin(blockOffset + BLOCK_SIZE, length);
+
+    for (bool grown = true; grown && end < limit;) {
+        grown = false;
+        for (const auto &range : planned) {
+            if (range.end > end && range.begin <= end + MERGE_GAP && range.end > blockOffset) {
+                end = qMin(alignUp(range.end, BLOCK_SIZE), limit);
+                grown = true;
+            }
+        }
+    }
+
+    planned.erase(std::remove_if(planned.begin(), planned.end(), [&](const Range &range) {
+        return range.end <= end && range.begin + MERGE_GAP >= blockOffset;
+    }), planned.end());
+    return end;
+}
+
+// Reads the block at `blockOffset`, along with any hinted blocks after it, in
+// a single read.
+ByteSource::Block *ByteSource::fillBlocks(qint64 blockOffset) {
+    auto end = plannedEnd(blockOffset);
+    if (end - blockOffset <= BLOCK_SIZE) {
+        auto block = takeBlock();
+        if (!fill(blockOffset, end - blockOffset, block->data)) {
+            return nullptr;
+        }
+        block->offset = blockOffset;
+        block->lastUse = ++useCounter;
+        return block;
+    }
+
+    if (!fill(blockOffset, end - blockOffset, span)) {
+        return nullptr;
+    }
+
+    // Blocks may move as the cache grows, so look the first one up again at
+    // the end.
+    for (auto offset = blockOffset; offset < end; offset += BLOCK_SIZE) {
+        bool cached = std::any_of(blocks.cbegin(), blocks.cend(), [offset](const Block &block) {
+            return block.offset == offset;
+        });
+        if (cached) {
+            continue;
+        }
+        auto block = takeBlock();
+        block->data = span.mid(int(offset - blockOffset), int(BLOCK_SIZE));
+        block->offset = offset;
+        block->lastUse = ++useCounter;
+        block->prefetched = offset != blockOffset;
+    }
+    for (auto &block : blocks) {
+        if (block.offset == blockOffset) {
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+const uchar *ByteSource::viewCached(qint64 offset, qint64 count) {
+    qint64 blockOffset = offset & ~(BLOCK_SIZE - 1);
+
+    // Ranges that straddle a block boundary are rare (icon bodies, mostly).
+    // They are put together from cached blocks when they were prefetched, and
+    // otherwise get their own read rather than polluting the cache.
+    if (offset + count > blockOffset + BLOCK_SIZE) {
+        auto end = offset + count;
+        bool cached = true;
+        for (auto block = blockOffset; block < end && cached; block += BLOCK_SIZE) {
+            cached = std::any_of(blocks.cbegin(), blocks.cend(), [block](const Block &b) {
+                return b.offset == block;
+            });
+        }
+        if (!cached) {
+            if (!fill(offset, count, scratch)) {
+                return nullptr;
+            }
+            return reinterpret_cast<const uchar *>(scratch.constData());
+        }
+
+        scratch.resize(int(count));
+        for (auto block = blockOffset; block < end; block += BLOCK_SIZE) {
+            auto b = findBlock(block);
+            auto from = qMax(offset, block);
+            auto to = qMin(end, block + qint64(b->data.size()));
+            std::memcpy(scratch.data() + (from - offset), b->data.constData() + (from - block), size_t(to - from));
+        }
+        return reinterpret_cast<const uchar *>(scratch.constData());
+    }
+
+    if (auto block = findBlock(blockOffset)) {
+        return reinterpret_cast<const uchar *>(block->data.constData()) + (offset - blockOffset);
+    }
+
+    auto block = fillBlocks(blockOffset);
+    if (!block) {
+        return nullptr;
+    }
+    return reinterpret_cast<const uchar *>(block->data.constData()) + (offset - blockOffset);
+}
+
+bool ByteReader::seek(qint64 pos) {
+    if (pos < 0 || pos > src.size()) {
+        good = false;
+        return false;
+    }
+    offset = pos;
+    return true;
+}
+
+bool ByteReader::skip(qint64 count) {
+    return seek(offset + count);
+}
+
+const uchar *ByteReader::read(qint64 count) {
+    auto p = peek(count);
+    if (p) {
+        offset += count;
+    }
+    return p;
+}
+
+const uchar *ByteReader::peek(qint64 count) {
+    auto p = src.view(offset, count);
+    if (!p) {
+        good = false;
+    }
+    return p;
+}
+
+QByteArray ByteReader::peekRawBytes(qint64 count) {
+    auto p = peek(count);
+    if (!p) {
+        return {};
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(p), count);
+}
+
+bool ByteReader::readRawData(char *out, qint64 count) {
+    auto p = read(count);
+    if (!p) {
+        std::memset(out, 0, count);
+        return false;
+    }
+    std::memcpy(out, p, count);
+    return true;
+}
+
+namespace {
+
+template<typename T>
+ByteReader &readLittleEndian(ByteReader &r, T &v) {
+    auto p = r.read(sizeof(T));
+    v = p ? qFromLittleEndian<T>(p) : T{};
+    return r;
+}
+
+}
+
+ByteReader &operator>>(ByteReader &r, quint8 &v) { return readLittleEndian(r, v); }
+ByteReader &operator>>(ByteReader &r, quint16 &v) { return readLittleEndian(r, v); }
+ByteReader &operator>>(ByteReader &r, quint32 &v) { return readLittleEndian(r, v); }
+ByteReader &operator>>(ByteReader &r, qint32 &v) { return readLittleEndian(r, v); }
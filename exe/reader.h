@@ -0,0 +1,137 @@
+#pragma once
+#include <QtGlobal>
+#include <QByteArray>
+#include <QVector>
+
+#include <limits>
+
+class QIODevice;
+class QFileDevice;
+
+// Random-access byte source over an executable file.
+//
+// Devices that can be memory-mapped are mapped once and all views are handed
+// out zero-copy. Anything else (sockets, buffers, remote devices) goes through
+// a small LRU cache of page-aligned blocks so that scattered header reads don't
+// turn into one syscall each.
+class ByteSource {
+public:
+    struct Stats {
+        qint64 bytesRead = 0;
+        int reads = 0;
+        int seeks = 0;
+        // Ranges hinted with willNeed(), and reads that didn't happen because
+        // the data came in with an earlier, coalesced read.
+        int hints = 0;
+        int readsSaved = 0;
+    };
+
+    // Size and alignment of the blocks the cached path reads.
+    static constexpr qint64 BLOCK_SIZE = 16 * 1024;
+
+    explicit ByteSource(QIODevice *device);
+    // Wraps memory that outlives the source; views are always zero-copy.
+    ByteSource(const uchar *data, qint64 size);
+    ~ByteSource();
+
+    ByteSource(const ByteSource &) = delete;
+    ByteSource &operator=(const ByteSource &) = delete;
+
+    qint64 size() const { return length; }
+    bool isMapped() const { return data != nullptr; }
+    const Stats &stats() const { return counters; }
+
+    // Fails every view once `bytes` more have been viewed. The source counts
+    // as over budget from then until the next call.
+    void setReadBudget(qint64 bytes);
+    bool overReadBudget() const { return overBudget; }
+
+    // Whether a read from the device has failed or come up short. Views
+    // outside the file don't count; they fail the same way every time.
+    bool readFailed() const { return failed; }
+
+    // Returns a pointer to `count` bytes at `offset`, or nullptr if the range
+    // is out of bounds or can't be read. When the source isn't mapped, the
+    // pointer is only valid until the next call to view().
+    const uchar *view(qint64 offset, qint64 count);
+
+    // Hints that the parser will soon need [offset, offset + count). Files get
+    // kernel readahead hints, so that on network mounts the data is already
+    // in flight. On the cached path, hinted ranges near a cache miss are
+    // fetched together with it in one larger read.
+    void willNeed(qint64 offset, qint64 count);
+
+private:
+    struct Block {
+        qint64 offset = -1;
+        quint64 lastUse = 0;
+        bool prefetched = false;
+        QByteArray data;
+    };
+
+    struct Range {
+        qint64 begin;
+        qint64 end;
+    };
+
+    bool fill(qint64 offset, qint64 count, QByteArray &out);
+    const uchar *viewCached(qint64 offset, qint64 count);
+    Block *findBlock(qint64 blockOffset);
+    Block *takeBlock();
+    qint64 plannedEnd(qint64 blockOffset);
+    Block *fillBlocks(qint64 blockOffset);
+
+    QIODevice *device = nullptr;
+    QFileDevice *file = nullptr;
+    uchar *mapping = nullptr;
+    const uchar *data = nullptr;
+    qint64 length = 0;
+
+    QVector<Block> blocks;
+    QVector<Range> planned;
+    QByteArray scratch;
+    QByteArray span;
+    quint64 useCounter = 0;
+    Stats counters;
+    qint64 budget = std::numeric_limits<qint64>::max();
+    bool overBudget = false;
+    bool failed = false;
+};
+
+// Little-endian cursor over a ByteSource.
+//
+// Reads past the end of the source leave the cursor in an error state and
+// yield zeroed values, much like QDataStream does. The error state is sticky
+// until resetStatus(), but doesn't prevent further reads.
+class ByteReader {
+public:
+    explicit ByteReader(ByteSource *source) : src{*source} {}
+
+    ByteSource &source() { return src; }
+
+    qint64 pos() const { return offset; }
+    bool ok() const { return good; }
+    void resetStatus() { good = true; }
+
+    bool seek(qint64 pos);
+    bool skip(qint64 count);
+
+    // Returns a pointer to the next `count` bytes and advances past them.
+    const uchar *read(qint64 count);
+    const uchar *peek(qint64 count);
+    // Like peek(), but wrapped in a QByteArray that doesn't own its data.
+    QByteArray peekRawBytes(qint64 count);
+    bool readRawData(char *out, qint64 count);
+
+    void willNeed(qint64 pos, qint64 count) { src.willNeed(pos, count); }
+
+private:
+    ByteSource &src;
+    qint64 offset = 0;
+    bool good = true;
+};
+
+ByteReader &operator>>(ByteReader &r, quint8 &v);
+ByteReader &operator>>(ByteReader &r, quint16 &v);
+ByteReader &operator>>(ByteReader &r, quint32 &v);
+ByteReader &operator>>(ByteReader &r, qint32 &v);
@@ -1,28 +1,58 @@
 #include "resource.h"
 
-#include <QDataStream>
+#include "budget.h"
+#include "layout.h"
+#include "reader.h"
 
-QDataStream &operator>>(QDataStream &s, RtGroupIconDirectory &v) {
-    s >> v.reserved >> v.type >> v.count;
-    return s;
+template<> struct LayoutOf<RtGroupIconDirectory> : Layout<RtGroupIconDirectory, 6,
+    Field<0, &RtGroupIconDirectory::reserved>,
+    Field<2, &RtGroupIconDirectory::type>,
+    Field<4, &RtGroupIconDirectory::count>> {};
+
+template<> struct LayoutOf<RtGroupIconDirectoryEntry> : Layout<RtGroupIconDirectoryEntry, 14,
+    Field<0, &RtGroupIconDirectoryEntry::width>,
+    Field<1, &RtGroupIconDirectoryEntry::height>,
+    Field<2, &RtGroupIconDirectoryEntry::colorCount>,
+    Field<3, &RtGroupIconDirectoryEntry::reserved>,
+    Field<4, &RtGroupIconDirectoryEntry::numPlanes>,
+    Field<6, &RtGroupIconDirectoryEntry::bpp>,
+    Field<8, &RtGroupIconDirectoryEntry::size>,
+    Field<12, &RtGroupIconDirectoryEntry::resourceId>> {};
+
+ByteReader &operator>>(ByteReader &s, RtGroupIconDirectory &v) {
+    return readStruct(s, v);
 }
 
-QDataStream &operator>>(QDataStream &s, RtGroupIconDirectoryEntry &v) {
-    s >> v.width >> v.height >> v.colorCount >> v.reserved
-      >> v.numPlanes >> v.bpp >> v.size >> v.resourceId;
-    return s;
+ByteReader &operator>>(ByteReader &s, RtGroupIconDirectoryEntry &v) {
+    return readStruct(s, v);
 }
 
-QVector<RtGroupIconDirectoryEntry> readResourceDirectory(QDataStream &s) {
-    RtGroupIconDirectory header;
-    s >> header;
+QSize groupEntrySize(const RtGroupIconDirectoryEntry &entry) {
+    return {entry.width ? entry.width : 256, entry.height ? entry.height : 256};
+}
 
-    QVector<RtGroupIconDirectoryEntry> result;
-    for (int i = 0; i < header.count; i++) {
-        RtGroupIconDirectoryEntry entry;
-        s >> entry;
-        result.append(entry);
+int groupEntryBpp(const RtGroupIconDirectoryEntry &entry) {
+    if (entry.bpp) {
+        return entry.bpp;
+    }
+    // A color count of 0 means 256 or more, which says nothing about the
+    // depth.
+    if (entry.colorCount == 0) {
+        return 0;
     }
+    int bpp = 1;
+    while ((1 << bpp) < entry.colorCount) {
+        bpp++;
+    }
+    return bpp;
+}
 
-    return result;
+bool readResourceDirectory(ByteReader &s, ArenaVector<RtGroupIconDirectoryEntry> &out, ParseBudget *budget) {
+    RtGroupIconDirectory header;
+    s >> header;
+    if (budget && !budget->spendEntries(header.count)) {
+        out.clear();
+        return false;
+    }
+    return readArray(s, header.count, out);
 }
@@ -1,5 +1,11 @@
 #pragma once
+#include "arena.h"
+
 #include <QtGlobal>
+#include <QSize>
+
+class ByteReader;
+class ParseBudget;
 
 enum class ResourceType : quint32 {
     Icon = 3,
@@ -23,6 +29,16 @@ struct RtGroupIconDirectoryEntry {
     quint16 resourceId;
 };
 
-QDataStream &operator>>(QDataStream &s, RtGroupIconDirectoryEntry &v);
-QDataStream &operator>>(QDataStream &s, RtGroupIconDirectory &v);
-QVector<RtGroupIconDirectoryEntry> readResourceDirectory(QDataStream &s);
+ByteReader &operator>>(ByteReader &s, RtGroupIconDirectoryEntry &v);
+
+// Size and depth as declared by the group directory, without touching the
+// icon itself. A width or height of 0 means 256, and old icons leave bpp at 0
+// and only give the number of palette colors. When an entry gives neither,
+// as many PNG and 32-bit entries do, the depth is 0: unknown until the icon's
+// own header is read.
+QSize groupEntrySize(const RtGroupIconDirectoryEntry &entry);
+int groupEntryBpp(const RtGroupIconDirectoryEntry &entry);
+
+ByteReader &operator>>(ByteReader &s, RtGroupIconDirectory &v);
+// Reads a group icon directory, charging its entries to `budget` if given.
+bool readResourceDirectory(ByteReader &s, ArenaVector<RtGroupIconDirectoryEntry> &out, ParseBudget *budget = nullptr);
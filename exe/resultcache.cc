@@ -0,0 +1,32 @@
+#include "resultcache.h"
+
+#include <limits>
+
+ResultCache::ResultCache(qint64 maxBytes) {
+    // Costs are in KiB, as in IconCache; a failure counts as one.
+    entries.setMaxCost(int(qMin<qint64>(maxBytes / 1024, std::numeric_limits<int>::max())));
+}
+
+bool ResultCache::find(const ThumbnailKey &key, QImage &image, const char *&reason) {
+    auto entry = entries.object(key);
+    if (!entry) {
+        entry = entries.object(anySize(key));
+    }
+    if (!entry) {
+        return false;
+    }
+    image = entry->image;
+    reason = entry->reason;
+    return true;
+}
+
+void ResultCache::insert(const ThumbnailKey &key, const QImage &image) {
+    if (image.isNull()) {
+        return;
+    }
+    entries.insert(key, new Entry{image, nullptr}, int(qMax<qint64>(image.sizeInBytes() / 1024, 1)));
+}
+
+void ResultCache::insertFailure(const ThumbnailKey &key, const char *reason) {
+    entries.insert(anySize(key), new Entry{QImage(), reason}, 1);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "thumbindex.h"
+
+#include <QtGlobal>
+#include <QCache>
+#include <QImage>
+
+// Thumbnails and failures from recent requests, kept in memory.
+//
+// Sits in front of the ThumbnailIndex, so that view refreshes and zooming
+// over a folder answer from memory without reopening any file. A file that failed
+// fails at every size, so failures are kept once per version of the file,
+// along with the reason, and cost next to nothing. Bounded by the bytes of
+// the thumbnails held; least recently used entries go first. Not
+// thread-safe.
+class ResultCache {
+public:
+    explicit ResultCache(qint64 maxBytes = 16 * 1024 * 1024);
+
+    // Returns true if the outcome for `key` is known. A null image means the
+    // request failed for `reason`.
+    bool find(const ThumbnailKey &key, QImage &image, const char *&reason);
+
+    void insert(const ThumbnailKey &key, const QImage &image);
+    // `reason` must be a string literal or otherwise live forever.
+    void insertFailure(const ThumbnailKey &key, const char *reason);
+
+private:
+    struct Entry {
+        QImage image;
+        const char *reason = nullptr;
+    };
+
+    QCache<ThumbnailKey, Entry> entries;
+};
@@ -0,0 +1,369 @@
+#include "thumbindex.h"
+#include "exeutil.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QVector>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/stat.h>
+
+namespace {
+
+constexpr char FILE_MAGIC[8] = {'P', 'E', 'T', 'H', 'I', 'D', 'X', '2'};
+constexpr quint32 RECORD_MAGIC = 0x58444950; // "PIDX"
+
+// magic, PARSER_VERSION of the process that created the file
+constexpr qint64 HEADER_SIZE = 8 + 4;
+
+// magic, device, inode, size, mtime
+constexpr qint64 RECORD_SIZE = 4 + 8 + 8 + 8 + 8;
+
+// Compaction kicks in once the file is at least this big and more than half
+// of it is superseded, or once the live records alone exceed the cap. The cap
+// drops the oldest records.
+constexpr qint64 COMPACT_MIN_SIZE = 256 << 10;
+constexpr qint64 MAX_LIVE_SIZE = 4 << 20;
+
+// How long to wait for another process that is creating or replacing the
+// index.
+constexpr int CREATE_LOCK_TIMEOUT_MS = 1000;
+
+QString lockPath(const QString &path) {
+    return path + QStringLiteral(".lock");
+}
+
+struct Record {
+    ThumbnailKey key;
+    qint64 offset;
+};
+
+// Parses the record at `offset`. Fails at the end of the data and at a torn
+// or corrupt record, which ends the usable part of the file.
+bool parseRecord(const uchar *data, qint64 size, qint64 offset, Record &out) {
+    if (offset < 0 || size - offset < RECORD_SIZE) {
+        return false;
+    }
+
+    auto p = data + offset;
+    if (qFromLittleEndian<quint32>(p) != RECORD_MAGIC) {
+        return false;
+    }
+    out.key.device = qFromLittleEndian<quint64>(p + 4);
+    out.key.inode = qFromLittleEndian<quint64>(p + 12);
+    out.key.size = qFromLittleEndian<qint64>(p + 20);
+    out.key.mtimeNs = qFromLittleEndian<qint64>(p + 28);
+    out.key.width = 0;
+    out.key.height = 0;
+    out.offset = offset;
+    return true;
+}
+
+QByteArray encodeRecord(const ThumbnailKey &key) {
+    QByteArray record{int(RECORD_SIZE), Qt::Uninitialized};
+    auto p = reinterpret_cast<uchar *>(record.data());
+    qToLittleEndian<quint32>(RECORD_MAGIC, p);
+    qToLittleEndian<quint64>(key.device, p + 4);
+    qToLittleEndian<quint64>(key.inode, p + 12);
+    qToLittleEndian<qint64>(key.size, p + 20);
+    qToLittleEndian<qint64>(key.mtimeNs, p + 28);
+    return record;
+}
+
+QByteArray encodeHeader() {
+    QByteArray header{int(HEADER_SIZE), Qt::Uninitialized};
+    std::memcpy(header.data(), FILE_MAGIC, sizeof(FILE_MAGIC));
+    qToLittleEndian<quint32>(PARSER_VERSION, header.data() + sizeof(FILE_MAGIC));
+    return header;
+}
+
+// Fails for files that aren't an index at all.
+bool readHeader(const uchar *data, qint64 size, quint32 &version) {
+    if (size < HEADER_SIZE || std::memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        return false;
+    }
+    version = qFromLittleEndian<quint32>(data + sizeof(FILE_MAGIC));
+    return true;
+}
+
+// Returns the newest record for each file among the records from `offset`
+// on, and sets `end` to the offset just past the last of them.
+QHash<ThumbnailKey, Record> scanRecords(const uchar *data, qint64 size, qint64 offset, qint64 &end) {
+    // A newer version of a file supersedes every older record for the same
+    // file.
+    QHash<ThumbnailKey, Record> live;
+    Record record;
+    for (; parseRecord(data, size, offset, record); offset += RECORD_SIZE) {
+        live[anyVersion(record.key)] = record;
+    }
+    end = offset;
+    return live;
+}
+
+// Starts the index at `path` afresh, under the same lock as compaction.
+bool replaceWithEmptyIndex(const QString &path) {
+    QLockFile lock{lockPath(path)};
+    if (!lock.tryLock(CREATE_LOCK_TIMEOUT_MS)) {
+        return false;
+    }
+    QSaveFile out{path};
+    return out.open(QIODevice::WriteOnly) && out.write(encodeHeader()) == HEADER_SIZE && out.commit();
+}
+
+// Rewrites the index with only the live records. This runs on a worker
+// thread and only touches the file on disk; records other processes append
+// between the scan and the rename are lost, which is fine for a cache.
+void compactIndex(const QString &path) {
+    QLockFile lock{lockPath(path)};
+    if (!lock.tryLock(0)) {
+        return;
+    }
+
+    QFile in{path};
+    if (!in.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    auto size = in.size();
+    auto data = in.map(0, size);
+    if (!data) {
+        return;
+    }
+
+    // An index of another parser version is left to the processes of that
+    // version.
+    quint32 version;
+    if (!readHeader(data, size, version) || version != PARSER_VERSION) {
+        in.unmap(data);
+        return;
+    }
+
+    qint64 end;
+    auto live = scanRecords(data, size, HEADER_SIZE, end).values();
+    std::sort(live.begin(), live.end(), [](const Record &a, const Record &b) {
+        return a.offset < b.offset;
+    });
+
+    const auto keep = int(MAX_LIVE_SIZE / RECORD_SIZE);
+    const auto first = live.size() > keep ? live.size() - keep : 0;
+
+    QSaveFile out{path};
+    if (out.open(QIODevice::WriteOnly)) {
+        out.write(encodeHeader());
+        for (auto i = first; i < live.size(); i++) {
+            out.write(reinterpret_cast<const char *>(data + live[i].offset), RECORD_SIZE);
+        }
+        out.commit();
+    }
+
+    in.unmap(data);
+}
+
+}
+
+bool ThumbnailKey::forFile(const QString &path, QSize targetSize, ThumbnailKey &out) {
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) != 0) {
+        return false;
+    }
+
+    out.device = st.st_dev;
+    out.inode = st.st_ino;
+    out.size = st.st_size;
+    out.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    out.width = quint16(qBound(0, targetSize.width(), 0xffff));
+    out.height = quint16(qBound(0, targetSize.height(), 0xffff));
+    return true;
+}
+
+bool operator==(const ThumbnailKey &a, const ThumbnailKey &b) {
+    return a.device == b.device && a.inode == b.inode &&
+           a.size == b.size && a.mtimeNs == b.mtimeNs &&
+           a.width == b.width && a.height == b.height;
+}
+
+size_t qHash(const ThumbnailKey &key, size_t seed) {
+    return qHash(key.inode ^ (key.device << 32), seed) ^
+           qHash(quint64(key.mtimeNs) ^ quint64(key.size), seed) ^
+           qHash((uint(key.width) << 16) | key.height, seed);
+}
+
+ThumbnailKey anyVersion(ThumbnailKey key) {
+    key.size = 0;
+    key.mtimeNs = 0;
+    return key;
+}
+
+ThumbnailKey anySize(ThumbnailKey key) {
+    key.width = 0;
+    key.height = 0;
+    return key;
+}
+
+ThumbnailIndex::ThumbnailIndex(const QString &path)
+    : path{path}
+{
+}
+
+ThumbnailIndex::~ThumbnailIndex() {
+    close();
+}
+
+QString ThumbnailIndex::defaultPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) +
+           QStringLiteral("/kio-windows-thumbnails/index");
+}
+
+bool ThumbnailIndex::open() {
+    opened = true;
+
+    QDir{}.mkpath(QFileInfo{path}.absolutePath());
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append | QIODevice::Unbuffered)) {
+        return false;
+    }
+
+    // A new file. Other workers may be creating it at the same time, so the
+    // header is written by whoever gets the lock first, and only ever to an
+    // empty file.
+    if (file.size() == 0) {
+        QLockFile lock{lockPath(path)};
+        if (!lock.tryLock(CREATE_LOCK_TIMEOUT_MS)) {
+            file.close();
+            return false;
+        }
+        if (file.size() == 0 && file.write(encodeHeader()) != HEADER_SIZE) {
+            file.close();
+            return false;
+        }
+    }
+
+    quint32 version = 0;
+    bool ours = false;
+    if (auto header = file.map(0, HEADER_SIZE, QFileDevice::MapPrivateOption)) {
+        ours = readHeader(header, HEADER_SIZE, version);
+        file.unmap(header);
+    }
+
+    // Failures found by an older parser may have icons now, so its index is
+    // replaced with an empty one, and picked up again at the next lookup.
+    if (ours && version < PARSER_VERSION) {
+        file.close();
+        if (replaceWithEmptyIndex(path)) {
+            opened = false;
+        }
+        return false;
+    }
+
+    // An index that isn't ours, or belongs to a newer parser, is left alone
+    // and stays off in this process; other workers may be using it just fine.
+    if (!ours || version != PARSER_VERSION) {
+        file.close();
+        return false;
+    }
+
+    scannedSize = HEADER_SIZE;
+    seenSize = HEADER_SIZE;
+    qint64 liveSize = 0;
+    if (scanAppended(&liveSize) && seenSize >= COMPACT_MIN_SIZE &&
+        (liveSize * 2 < seenSize || liveSize > MAX_LIVE_SIZE)) {
+        scheduleCompaction();
+    }
+
+    return true;
+}
+
+void ThumbnailIndex::close() {
+    file.close();
+    noIcon.clear();
+    scannedSize = 0;
+    seenSize = 0;
+    opened = false;
+}
+
+bool ThumbnailIndex::scanAppended(qint64 *liveSize) {
+    // A torn or corrupt record stops the scan until the file grows again.
+    const auto size = file.size();
+    if (size <= seenSize) {
+        return true;
+    }
+
+    auto data = file.map(scannedSize, size - scannedSize, QFileDevice::MapPrivateOption);
+    if (!data) {
+        return false;
+    }
+    qint64 end;
+    const auto live = scanRecords(data, size - scannedSize, 0, end);
+    file.unmap(data);
+
+    noIcon.reserve(noIcon.size() + live.size());
+    for (const auto &record : live) {
+        noIcon.insert(anySize(record.key));
+    }
+    if (liveSize) {
+        *liveSize = live.size() * RECORD_SIZE;
+    }
+    scannedSize += end;
+    seenSize = size;
+    return true;
+}
+
+void ThumbnailIndex::scheduleCompaction() {
+    QThreadPool::globalInstance()->start([path = path] {
+        compactIndex(path);
+    });
+}
+
+bool ThumbnailIndex::replacedOnDisk() const {
+    struct stat ours, onDisk;
+    if (::fstat(file.handle(), &ours) != 0) {
+        return false;
+    }
+    if (::stat(QFile::encodeName(path).constData(), &onDisk) != 0) {
+        return true;
+    }
+    return ours.st_dev != onDisk.st_dev || ours.st_ino != onDisk.st_ino;
+}
+
+bool ThumbnailIndex::prepare() {
+    // Compaction, by this process or any other, renames a new file over the
+    // index; records appended to the old one would be lost to everyone else.
+    if (file.isOpen() && replacedOnDisk()) {
+        close();
+    }
+    if (!opened) {
+        open();
+    }
+    return file.isOpen();
+}
+
+bool ThumbnailIndex::hasNoIcon(const ThumbnailKey &key) {
+    QMutexLocker locker{&mutex};
+    if (!prepare()) {
+        return false;
+    }
+    // A failed scan is retried on the next lookup rather than turning the
+    // index off.
+    scanAppended();
+    return noIcon.contains(anySize(key));
+}
+
+void ThumbnailIndex::insertNoIcon(const ThumbnailKey &key) {
+    QMutexLocker locker{&mutex};
+    if (!prepare()) {
+        return;
+    }
+
+    // One write per record, so concurrent appends from other processes
+    // don't interleave.
+    auto record = encodeRecord(key);
+    if (file.write(record) == record.size()) {
+        noIcon.insert(anySize(key));
+    }
+}
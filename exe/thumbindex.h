@@ -0,0 +1,82 @@
+#pragma once
+#include <QtGlobal>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+#include <QSize>
+#include <QString>
+
+// Identifies one thumbnail size of one version of a file. Rewriting a file
+// changes its size or mtime; replacing it changes the inode.
+struct ThumbnailKey {
+    quint64 device = 0;
+    quint64 inode = 0;
+    qint64 size = 0;
+    qint64 mtimeNs = 0;
+    quint16 width = 0;
+    quint16 height = 0;
+
+    static bool forFile(const QString &path, QSize targetSize, ThumbnailKey &out);
+};
+
+bool operator==(const ThumbnailKey &a, const ThumbnailKey &b);
+size_t qHash(const ThumbnailKey &key, size_t seed = 0);
+
+// The same file and thumbnail size, whichever version of the file.
+ThumbnailKey anyVersion(ThumbnailKey key);
+// The same version of the file, at any thumbnail size.
+ThumbnailKey anySize(ThumbnailKey key);
+
+// Persistent index of files without an icon, shared by every thumbnailer
+// process of a user. KIO caches the thumbnails themselves, but nothing
+// remembers the files it failed on, and those get parsed again on every visit.
+//
+// The index is a single append-only file of records, each holding the key of
+// a file version that has no icon. It is scanned when opened to build an
+// in-memory set, and every lookup first scans whatever this or any other
+// process appended since, so lookups cost an fstat() and one hash probe. New
+// records are appended with a single write. Once most of the file is
+// superseded records, it is rewritten in the background keeping only the
+// newest record for each file, and atomically renamed into place. Every
+// process notices the rename at its next lookup or insert and reopens the
+// index.
+//
+// The header records the PARSER_VERSION that wrote the file. A newer parser
+// may find icons an older one missed, so it starts the index afresh, while an
+// older one leaves a newer index alone and runs without one.
+class ThumbnailIndex {
+public:
+    explicit ThumbnailIndex(const QString &path = defaultPath());
+    ~ThumbnailIndex();
+
+    ThumbnailIndex(const ThumbnailIndex &) = delete;
+    ThumbnailIndex &operator=(const ThumbnailIndex &) = delete;
+
+    static QString defaultPath();
+
+    // Whether this version of the file is recorded as having no icon. The
+    // thumbnail size in `key` doesn't matter.
+    bool hasNoIcon(const ThumbnailKey &key);
+    // Records that this version of the file has no icon, at any size.
+    void insertNoIcon(const ThumbnailKey &key);
+
+private:
+    bool prepare();
+    bool open();
+    void close();
+    // Adds the records appended since the last scan; `liveSize` gets the
+    // size of the newest record of each file among them.
+    bool scanAppended(qint64 *liveSize = nullptr);
+    bool replacedOnDisk() const;
+    void scheduleCompaction();
+
+    QString path;
+    QMutex mutex;
+    QFile file;
+    // End of the last record scanned, and the file size at that scan.
+    qint64 scannedSize = 0;
+    qint64 seenSize = 0;
+    bool opened = false;
+    // Files without an icon, keyed with anySize().
+    QSet<ThumbnailKey> noIcon;
+};
@@ -0,0 +1,114 @@
+// Standalone thumbnailer for freedesktop.org desktops (GNOME, Xfce, ...),
+// using the same extraction code as the KIO plugin.
+//
+//     pethumbnailer -s 256 input.exe output.png
+//
+// With --batch, it reads tab-separated "input<TAB>output" lines from stdin
+// and thumbnails all of them in one process, spread across cores. Each line
+// gets a result on stdout: "ok", "none" (no icon) or "error", then the output
+// path.
+
+#include "batch.h"
+#include "exeutil.h"
+#include "iconcache.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QTextStream>
+
+int main(int argc, char **argv) {
+    QCoreApplication app{argc, argv};
+    QCoreApplication::setApplicationName(QStringLiteral("pethumbnailer"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Thumbnails Windows executables by their icon."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("input"), QStringLiteral("Executable to thumbnail; not used with --batch."));
+    parser.addPositionalArgument(QStringLiteral("output"), QStringLiteral("PNG file to write; not used with --batch."));
+
+    QCommandLineOption sizeOption{{QStringLiteral("s"), QStringLiteral("size")},
+        QStringLiteral("Maximum thumbnail size (default: 256)."), QStringLiteral("size"), QStringLiteral("256")};
+    QCommandLineOption batchOption{QStringLiteral("batch"),
+        QStringLiteral("Read tab-separated input and output paths from stdin, one pair per line.")};
+    QCommandLineOption threadsOption{{QStringLiteral("j"), QStringLiteral("threads")},
+        QStringLiteral("Worker threads in batch mode (default: one per core)."), QStringLiteral("count"), QStringLiteral("0")};
+    parser.addOption(sizeOption);
+    parser.addOption(batchOption);
+    parser.addOption(threadsOption);
+    parser.process(app);
+
+    bool ok = false;
+    int size = parser.value(sizeOption).toInt(&ok);
+    if (!ok || size <= 0) {
+        qWarning("Invalid size: %s", qPrintable(parser.value(sizeOption)));
+        return 1;
+    }
+
+    IconCache icons;
+    ExtractionOptions extraction;
+    extraction.iconCache = &icons;
+
+    if (!parser.isSet(batchOption)) {
+        auto args = parser.positionalArguments();
+        if (args.size() != 2) {
+            parser.showHelp(1);
+        }
+
+        QFile file{args[0]};
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+            qWarning("Unable to read %s", qPrintable(args[0]));
+            return 1;
+        }
+        auto image = getIconForWindowsExecutable(&file, {size, size}, extraction);
+        if (image.isNull()) {
+            return 1;
+        }
+        if (!writeThumbnail(fitThumbnail(image, size), args[1])) {
+            qWarning("Unable to write %s", qPrintable(args[1]));
+            return 1;
+        }
+        return 0;
+    }
+
+    QStringList inputs, outputs;
+    QTextStream in{stdin};
+    QString line;
+    while (in.readLineInto(&line)) {
+        auto fields = line.split(QLatin1Char('\t'));
+        if (fields.size() != 2 || fields[0].isEmpty() || fields[1].isEmpty()) {
+            if (!line.isEmpty()) {
+                qWarning("Ignoring malformed line: %s", qPrintable(line));
+            }
+            continue;
+        }
+        inputs.append(fields[0]);
+        outputs.append(fields[1]);
+    }
+
+    BatchOptions options;
+    options.extraction = extraction;
+    options.threads = parser.value(threadsOption).toInt();
+    options.concurrentCallback = true;
+
+    // Scaling and PNG encoding happen on the workers; only the reporting is
+    // serialized.
+    QMutex outMutex;
+    QTextStream out{stdout};
+    int failures = 0;
+    extractBatch(inputs, {{size, size}}, options, [&](BatchItem &item) {
+        bool written = !item.image.isNull() && writeThumbnail(fitThumbnail(item.image, size), outputs[item.index]);
+        const char *status = written ? "ok" : item.image.isNull() ? "none" : "error";
+
+        QMutexLocker locker{&outMutex};
+        if (!written) {
+            failures++;
+        }
+        out << status << '\t' << outputs[item.index] << '\n';
+        out.flush();
+    });
+
+    return failures ? 2 : 0;
+}
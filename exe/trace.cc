@@ -0,0 +1,239 @@
+#include "trace.h"
+#include "exeutil.h"
+#include "reader.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+
+#include <unistd.h>
+
+namespace {
+
+thread_local Trace *currentTrace = nullptr;
+std::atomic<const std::atomic<qint64> *> allocationCounter{nullptr};
+
+qint64 allocationsSoFar() {
+    auto counter = allocationCounter.load(std::memory_order_relaxed);
+    return counter ? counter->load(std::memory_order_relaxed) : 0;
+}
+
+// Where records go, set up on first use from the environment. Each record is
+// written with a single unbuffered append, so processes sharing a file don't
+// interleave.
+class Sink {
+public:
+    static Sink &instance() {
+        static Sink sink;
+        return sink;
+    }
+
+    bool enabled() const { return file.isOpen(); }
+    bool chrome() const { return chromeFormat; }
+
+    void write(const QByteArray &line) {
+        QMutexLocker locker{&mutex};
+        file.write(line);
+    }
+
+private:
+    Sink() {
+        chromeFormat = qgetenv("PETHUMBNAIL_TRACE_FORMAT") == "chrome";
+        auto path = QString::fromLocal8Bit(qgetenv("PETHUMBNAIL_TRACE"));
+        if (path.isEmpty()) {
+            return;
+        }
+
+        bool opened = path == QLatin1String("-")
+            ? file.open(stderr, QIODevice::WriteOnly | QIODevice::Unbuffered)
+            : (file.setFileName(path), file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered));
+        if (!opened) {
+            qWarning("Unable to open trace output %s", qPrintable(path));
+            return;
+        }
+
+        // Chrome's JSON array format may be left unterminated, so events can
+        // keep being appended from any number of processes.
+        if (chromeFormat && file.size() == 0) {
+            file.write("[\n");
+        }
+    }
+
+    QMutex mutex;
+    QFile file;
+    bool chromeFormat = false;
+};
+
+QJsonObject countersJson(const Trace::Counters &begin, const Trace::Counters &end, bool allocations) {
+    QJsonObject json{
+        {QStringLiteral("usecs"), double(end.nsecs - begin.nsecs) / 1000.0},
+        {QStringLiteral("bytes"), end.bytesRead - begin.bytesRead},
+        {QStringLiteral("reads"), end.reads - begin.reads},
+        {QStringLiteral("seeks"), end.seeks - begin.seeks},
+    };
+    if (allocations) {
+        json.insert(QStringLiteral("allocs"), end.allocations - begin.allocations);
+    }
+    return json;
+}
+
+}
+
+bool Trace::enabled() {
+    return Sink::instance().enabled();
+}
+
+Trace *Trace::current() {
+    return currentTrace;
+}
+
+void Trace::setAllocationCounter(const std::atomic<qint64> *counter) {
+    allocationCounter.store(counter);
+}
+
+Trace::Trace(const QString &file, QSize targetSize)
+    : previous{currentTrace}, file{file}, targetSize{targetSize},
+      startUsecs{QDateTime::currentMSecsSinceEpoch() * 1000}, allocationBaseline{allocationsSoFar()}
+{
+    timer.start();
+    currentTrace = this;
+}
+
+Trace::~Trace() {
+    currentTrace = previous;
+    if (source) {
+        detach(source);
+    }
+    write();
+}
+
+void Trace::attach(const ByteSource *source) {
+    if (this->source) {
+        detach(this->source);
+    }
+    this->source = source;
+    const auto &stats = source->stats();
+    baseline.bytesRead = stats.bytesRead;
+    baseline.reads = stats.reads;
+    baseline.seeks = stats.seeks;
+}
+
+void Trace::detach(const ByteSource *source) {
+    if (this->source != source) {
+        return;
+    }
+    auto now = sample();
+    carried.bytesRead = now.bytesRead;
+    carried.reads = now.reads;
+    carried.seeks = now.seeks;
+    this->source = nullptr;
+}
+
+void Trace::fail(const char *reason) {
+    if (!this->reason) {
+        this->reason = reason;
+    }
+}
+
+Trace::Counters Trace::sample() const {
+    Counters counters = carried;
+    counters.nsecs = timer.nsecsElapsed();
+    counters.allocations = allocationsSoFar() - allocationBaseline;
+    if (source) {
+        const auto &stats = source->stats();
+        counters.bytesRead += stats.bytesRead - baseline.bytesRead;
+        counters.reads += stats.reads - baseline.reads;
+        counters.seeks += stats.seeks - baseline.seeks;
+    }
+    return counters;
+}
+
+void Trace::addSpan(const char *name, const Counters &begin, const Counters &end) {
+    spans.append({name, begin, end});
+}
+
+void Trace::write() {
+    auto &sink = Sink::instance();
+    Counters zero;
+    auto total = sample();
+    bool allocations = allocationCounter.load(std::memory_order_relaxed) != nullptr;
+
+    QJsonObject result{
+        {QStringLiteral("file"), file},
+        {QStringLiteral("ok"), (found || cached) && !reason},
+        {QStringLiteral("format"), QLatin1String(formatName(exeFormat))},
+    };
+    if (targetSize.isValid()) {
+        result.insert(QStringLiteral("target"), targetSize.width());
+    }
+    if (cached) {
+        result.insert(QStringLiteral("cached"), true);
+    }
+    if (found) {
+        result.insert(QStringLiteral("kind"), QLatin1String(icon.png ? "png" : "dib"));
+        result.insert(QStringLiteral("bpp"), icon.bpp);
+        result.insert(QStringLiteral("size"), QStringLiteral("%1x%2").arg(icon.size.width()).arg(icon.size.height()));
+    }
+    if (reason) {
+        result.insert(QStringLiteral("reason"), QLatin1String(reason));
+    }
+    if (hasPool) {
+        result.insert(QStringLiteral("pool"), QJsonObject{
+            {QStringLiteral("hits"), pool.hits},
+            {QStringLiteral("misses"), pool.misses},
+            {QStringLiteral("inUse"), pool.bytesInUse},
+            {QStringLiteral("free"), pool.bytesFree},
+            {QStringLiteral("peak"), pool.peakBytes},
+        });
+    }
+
+    if (!sink.chrome()) {
+        QJsonObject record = result;
+        record.insert(QStringLiteral("ts"), startUsecs);
+        record.insert(QStringLiteral("pid"), qint64(::getpid()));
+        auto totals = countersJson(zero, total, allocations);
+        for (auto it = totals.constBegin(); it != totals.constEnd(); ++it) {
+            record.insert(it.key(), it.value());
+        }
+        QJsonArray phases;
+        for (const auto &span : spans) {
+            auto phase = countersJson(span.begin, span.end, allocations);
+            phase.insert(QStringLiteral("name"), QLatin1String(span.name));
+            phase.insert(QStringLiteral("start"), double(span.begin.nsecs) / 1000.0);
+            phases.append(phase);
+        }
+        record.insert(QStringLiteral("phases"), phases);
+        sink.write(QJsonDocument{record}.toJson(QJsonDocument::Compact) + '\n');
+        return;
+    }
+
+    // One complete ("X") event for the request and one for each phase, which
+    // the viewer nests by time.
+    auto pid = qint64(::getpid());
+    auto tid = qint64(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+    auto event = [&](const QString &name, const Counters &begin, const Counters &end, QJsonObject args) {
+        auto counters = countersJson(begin, end, allocations);
+        for (auto it = counters.constBegin(); it != counters.constEnd(); ++it) {
+            args.insert(it.key(), it.value());
+        }
+        QJsonObject json{
+            {QStringLiteral("name"), name},
+            {QStringLiteral("cat"), QStringLiteral("pethumbnail")},
+            {QStringLiteral("ph"), QStringLiteral("X")},
+            {QStringLiteral("ts"), double(startUsecs) + double(begin.nsecs) / 1000.0},
+            {QStringLiteral("dur"), double(end.nsecs - begin.nsecs) / 1000.0},
+            {QStringLiteral("pid"), pid},
+            {QStringLiteral("tid"), tid},
+            {QStringLiteral("args"), args},
+        };
+        sink.write(QJsonDocument{json}.toJson(QJsonDocument::Compact) + ",\n");
+    };
+    event(QStringLiteral("thumbnail"), zero, total, result);
+    for (const auto &span : spans) {
+        event(QString::fromLatin1(span.name), span.begin, span.end, {});
+    }
+}
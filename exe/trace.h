@@ -0,0 +1,112 @@
+#pragma once
+#include "common.h"
+#include "pixelpool.h"
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QSize>
+#include <QString>
+#include <QVector>
+
+#include <atomic>
+
+class ByteSource;
+
+// Per-request tracing of the thumbnail pipeline.
+//
+// Off unless PETHUMBNAIL_TRACE names an output file, or "-" for stderr. While
+// a Trace is alive it is the current one for its thread, and TraceSpans
+// anywhere below it record their wall time and the I/O done in them. When the
+// Trace goes away it writes one record: a JSON line by default, or Chrome
+// trace events with PETHUMBNAIL_TRACE_FORMAT=chrome.
+class Trace {
+public:
+    struct Counters {
+        qint64 nsecs = 0;
+        qint64 bytesRead = 0;
+        qint64 reads = 0;
+        qint64 seeks = 0;
+        qint64 allocations = 0;
+    };
+
+    static bool enabled();
+    static Trace *current();
+
+    // Heap allocations are only counted in hosts that count them themselves,
+    // such as the benchmark.
+    static void setAllocationCounter(const std::atomic<qint64> *counter);
+
+    // `targetSize` may be left invalid when several sizes are rendered.
+    Trace(const QString &file, QSize targetSize = {});
+    ~Trace();
+
+    Trace(const Trace &) = delete;
+    Trace &operator=(const Trace &) = delete;
+
+    // I/O is counted from the attached source until it is detached again.
+    void attach(const ByteSource *source);
+    void detach(const ByteSource *source);
+
+    void setFormat(ExeFormat format) { exeFormat = format; }
+    void setIcon(const IconInfo &info) { icon = info; found = true; }
+    // The thumbnail came from a cache without touching the file.
+    void setCached() { cached = true; }
+    void setPoolStats(const PixelPool::Stats &stats) { pool = stats; hasPool = true; }
+    // Records why the request failed; the first reason given sticks.
+    void fail(const char *reason);
+
+    Counters sample() const;
+    void addSpan(const char *name, const Counters &begin, const Counters &end);
+
+private:
+    struct Span {
+        const char *name;
+        Counters begin;
+        Counters end;
+    };
+
+    void write();
+
+    Trace *previous;
+    QString file;
+    QSize targetSize;
+    qint64 startUsecs;
+    QElapsedTimer timer;
+    const ByteSource *source = nullptr;
+    Counters baseline;
+    Counters carried;
+    qint64 allocationBaseline;
+    QVector<Span> spans;
+    ExeFormat exeFormat = ExeFormat::Unknown;
+    IconInfo icon;
+    bool found = false;
+    bool cached = false;
+    PixelPool::Stats pool;
+    bool hasPool = false;
+    const char *reason = nullptr;
+};
+
+// Times the enclosing scope as a phase of the current trace, if any. Costs a
+// thread-local load when tracing is off.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name) : name{name}, trace{Trace::current()} {
+        if (trace) {
+            begin = trace->sample();
+        }
+    }
+
+    ~TraceSpan() {
+        if (trace) {
+            trace->addSpan(name, begin, trace->sample());
+        }
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    Trace *trace;
+    Trace::Counters begin;
+};